@@ -0,0 +1,136 @@
+//===-- aggregate.cc ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#include "aggregate.h"
+#include <algorithm>
+#include "radix.h"
+
+namespace memoro {
+
+using namespace std;
+
+// below this many frees a comparison sort beats the radix histograms
+#define AGGREGATE_RADIX_MIN 16384ul
+
+AggregateScratch& ThreadAggregateScratch() {
+  static thread_local AggregateScratch scratch;
+  return scratch;
+}
+
+bool SortEnds(ThreadPool& pool, AggregateScratch& scratch,
+              const CancelFn& cancelled) {
+  size_t n = scratch.end_times.size();
+  if (n >= AGGREGATE_RADIX_MIN) {
+    // stable, so equal times stay in the order they were added
+    return RadixSort(pool, scratch.end_times, scratch.end_chunks, cancelled);
+  }
+
+  auto& ends = scratch.small_ends;
+  ends.resize(n);
+  for (size_t i = 0; i < n; i++)
+    ends[i] = {scratch.end_times[i], scratch.end_chunks[i]};
+  // chunk indexes are unique and were added in order, comparing them
+  // breaks ties the same way the stable radix sort does
+  sort(ends.begin(), ends.end());
+  for (size_t i = 0; i < n; i++) {
+    scratch.end_times[i] = ends[i].first;
+    scratch.end_chunks[i] = ends[i].second;
+  }
+  return true;
+}
+
+namespace {
+
+struct Event {
+  uint64_t time;
+  int64_t delta;
+  uint32_t trace;
+};
+
+// the order AggregateChunks emits events in: by time, and allocations
+// (including empty ones) before frees at the same time
+inline bool Before(uint64_t time, int64_t delta, uint64_t other_time,
+                   int64_t other_delta) {
+  return time < other_time ||
+         (time == other_time && delta >= 0 && other_delta < 0);
+}
+
+}  // namespace
+
+void UpdateAggregate(vector<TimeValue>& points, vector<uint32_t>& point_traces,
+                     const vector<uint8_t>& removed,
+                     const vector<TraceEvents>& added,
+                     uint64_t& max_aggregate) {
+  // every trace aggregate is a running total, turn it back into events
+  vector<Event> events;
+  size_t num_events = 0;
+  for (auto& a : added) num_events += a.points->size() - 1;
+  events.reserve(num_events);
+  for (auto& a : added) {
+    const vector<TimeValue>& p = *a.points;
+    for (size_t i = 1; i < p.size(); i++)
+      events.push_back({p[i].time, p[i].value - p[i - 1].value, a.trace});
+  }
+  // stable, so each trace keeps its own order of equal events
+  stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b) {
+    return Before(a.time, a.delta, b.time, b.delta);
+  });
+
+  // done in place, copying the global series would cost more than the
+  // merge. first drop the removed traces' events, turning the running
+  // totals into deltas on the way
+  size_t n = 1;
+  int64_t prev = 0;
+  for (size_t i = 1; i < points.size(); i++) {
+    TimeValue p = points[i];
+    uint32_t trace = point_traces[i - 1];
+    int64_t delta = p.value - prev;
+    prev = p.value;
+    if (removed[trace]) continue;
+    points[n] = {p.time, delta};
+    point_traces[n - 1] = trace;
+    n++;
+  }
+
+  // then merge the new events in from the back, on ties the events
+  // already in the aggregate go first
+  size_t total = n + events.size();
+  points.resize(total);
+  point_traces.resize(total - 1);
+  size_t i = n, j = events.size();
+  for (size_t out = total; j > 0; out--) {
+    const Event& e = events[j - 1];
+    if (i > 1 &&
+        Before(e.time, e.delta, points[i - 1].time, points[i - 1].value)) {
+      points[out - 1] = points[i - 1];
+      point_traces[out - 2] = point_traces[i - 2];
+      i--;
+    } else {
+      points[out - 1] = {e.time, e.delta};
+      point_traces[out - 2] = e.trace;
+      j--;
+    }
+  }
+
+  // and back to running totals
+  int64_t running = 0;
+  for (size_t k = 1; k < total; k++) {
+    int64_t delta = points[k].value;
+    running += delta;
+    if (delta >= 0 && running > max_aggregate) max_aggregate = running;
+    points[k].value = running;
+  }
+}
+
+}  // namespace memoro
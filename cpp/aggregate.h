@@ -0,0 +1,138 @@
+//===-- aggregate.h ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "chunkstore.h"
+#include "memoro.h"
+#include "threadpool.h"
+
+namespace memoro {
+
+// buffers reused by AggregateChunks, one set per thread so traces can be
+// aggregated concurrently without allocating for every one of them
+struct AggregateScratch {
+  // free events, time and the index of the chunk in the sweep
+  std::vector<uint64_t> end_times;
+  std::vector<uint32_t> end_chunks;
+  std::vector<std::pair<uint64_t, uint32_t>> small_ends;
+  // free for callers to collect the chunks to aggregate in
+  std::vector<uint32_t> chunks;
+};
+
+AggregateScratch& ThreadAggregateScratch();
+
+// sort scratch.end_times, carrying end_chunks along. equal times keep the
+// order they were added in. large sweeps are radix sorted on pool, and can
+// be cancelled between the radix passes, then it returns false
+bool SortEnds(ThreadPool& pool, AggregateScratch& scratch,
+              const CancelFn& cancelled = nullptr);
+
+// Build the live bytes timeline of a set of chunks: points gets {0, 0}
+// and then the running total after every allocation and free, in time
+// order. max_aggregate is raised to the highest total seen after an
+// allocation.
+//
+// position(i) is the store position of the i-th chunk, chunks have to
+// come in timestamp_start order. the frees are sorted up front and merged
+// into the allocations in one linear sweep; on equal times the allocation
+// goes first. if sources is given it gets the store position of the chunk
+// behind every point after the first. cancelled is polled while sorting
+// and every 64K allocations, false with points empty if it stopped.
+template <typename Position>
+bool AggregateChunks(const ChunkStore& store, size_t num_chunks,
+                     Position position, ThreadPool& pool,
+                     std::vector<TimeValue>& points, uint64_t& max_aggregate,
+                     std::vector<uint32_t>* sources = nullptr,
+                     const CancelFn& cancelled = nullptr) {
+  AggregateScratch& scratch = ThreadAggregateScratch();
+  const uint64_t* start = store.timestamp_start.data();
+  const uint64_t* end = store.timestamp_end.data();
+  const uint64_t* size = store.size.data();
+
+  scratch.end_times.resize(num_chunks);
+  scratch.end_chunks.resize(num_chunks);
+  for (size_t i = 0; i < num_chunks; i++) {
+    scratch.end_times[i] = end[position(i)];
+    scratch.end_chunks[i] = i;
+  }
+  if (!SortEnds(pool, scratch, cancelled)) {
+    points.clear();
+    return false;
+  }
+  const uint64_t* end_times = scratch.end_times.data();
+  const uint32_t* end_chunks = scratch.end_chunks.data();
+
+  points.clear();
+  points.reserve(num_chunks * 2 + 1);
+  points.push_back({0, 0});
+  if (sources) {
+    sources->clear();
+    sources->reserve(num_chunks * 2);
+  }
+  int64_t running = 0;
+  size_t i = 0, j = 0;
+  while (i < num_chunks) {
+    uint32_t c = position(i);
+    if (j < num_chunks && end_times[j] < start[c]) {
+      uint32_t e = position(end_chunks[j]);
+      running -= size[e];
+      points.push_back({end_times[j], running});
+      if (sources) sources->push_back(e);
+      j++;
+    } else {
+      if ((i & 0xffff) == 0 && i > 0 && cancelled && cancelled()) {
+        points.clear();
+        return false;
+      }
+      running += size[c];
+      if (running > max_aggregate) max_aggregate = running;
+      points.push_back({start[c], running});
+      if (sources) sources->push_back(c);
+      i++;
+    }
+  }
+  // the rest are frees
+  for (; j < num_chunks; j++) {
+    uint32_t e = position(end_chunks[j]);
+    running -= size[e];
+    points.push_back({end_times[j], running});
+    if (sources) sources->push_back(e);
+  }
+  return true;
+}
+
+// the aggregate of one trace, to merge into a global aggregate
+struct TraceEvents {
+  uint32_t trace;
+  const std::vector<TimeValue>* points;
+};
+
+// Update a global aggregate for traces switching in or out of it, without
+// aggregating all chunks again. point_traces holds the trace of every
+// point after the first. points of traces with removed[trace] set are
+// dropped and the points of the added trace aggregates merged in, all in
+// one pass over the global series. the result is what AggregateChunks
+// gives for the new set of traces, except that events at the same time
+// may come in a different order. max_aggregate is raised to the new peak.
+void UpdateAggregate(std::vector<TimeValue>& points,
+                     std::vector<uint32_t>& point_traces,
+                     const std::vector<uint8_t>& removed,
+                     const std::vector<TraceEvents>& added,
+                     uint64_t& max_aggregate);
+
+}  // namespace memoro
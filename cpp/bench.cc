@@ -0,0 +1,476 @@
+//===-- bench.cc ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+// standalone micro benchmarks for the data processing code, build with
+// `make bench`. not part of the node addon.
+//
+//   ./bench sort <num chunks | path/to/file.chunks> [threads]
+//   ./bench pattern <num chunks | path/to/file.chunks>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "chunkstore.h"
+#include "memoro.h"
+#include "pattern.h"
+#include "radix.h"
+#include "threadpool.h"
+
+using namespace std;
+using namespace memoro;
+
+template <typename F>
+static double TimeMs(F f) {
+  auto start = chrono::steady_clock::now();
+  f();
+  auto end = chrono::steady_clock::now();
+  return chrono::duration<double, milli>(end - start).count();
+}
+
+// chunks as the sanitizer writes them: roughly in order of free, so
+// starts are only partially sorted
+static void SyntheticChunks(size_t n, vector<Chunk>& chunks) {
+  mt19937_64 rng(42);
+  uniform_int_distribution<uint64_t> life(1, 1000000);
+  chunks.resize(n);
+  uint64_t now = 1000;
+  for (size_t i = 0; i < n; i++) {
+    now += rng() % 100;
+    uint64_t l = life(rng);
+    chunks[i].timestamp_end = now + l;
+    chunks[i].timestamp_start = now - (l < now ? l : 0);
+    chunks[i].size = 8 << (rng() % 10);
+    // a few hot allocation sites own most chunks, like in real programs
+    double u = double(rng()) / double(UINT64_MAX);
+    chunks[i].stack_index = uint32_t(n / 50 * u * u * u);
+    chunks[i].num_reads = rng() % 4;
+    chunks[i].num_writes = rng() % 4;
+    chunks[i].multi_thread = rng() % 64 == 0;
+    uint64_t first = chunks[i].timestamp_start + rng() % l;
+    chunks[i].timestamp_first_access = first;
+    chunks[i].timestamp_last_access = first + rng() % (chunks[i].timestamp_end - first);
+    chunks[i].access_interval_low = rng() % chunks[i].size;
+    chunks[i].access_interval_high =
+        chunks[i].access_interval_low +
+        rng() % (chunks[i].size - chunks[i].access_interval_low);
+    chunks[i].alloc_call_time = rng() % 1000;
+  }
+}
+
+static bool MapChunks(const string& path, vector<Chunk>& chunks) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+    close(fd);
+    return false;
+  }
+  char* map = (char*)mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return false;
+  Header header;
+  memcpy(&header, map, sizeof(Header));
+  size_t offset = sizeof(Header) + header.index_size * sizeof(uint16_t);
+  if ((size_t)st.st_size < offset + header.index_size * sizeof(Chunk)) {
+    munmap(map, st.st_size);
+    return false;
+  }
+  const Chunk* c = reinterpret_cast<const Chunk*>(map + offset);
+  chunks.assign(c, c + header.index_size);
+  munmap(map, st.st_size);
+  return true;
+}
+
+static bool ReadChunks(const string& input, vector<Chunk>& chunks) {
+  if (all_of(input.begin(), input.end(), ::isdigit)) {
+    SyntheticChunks(stoul(input), chunks);
+    return true;
+  }
+  if (MapChunks(input, chunks)) return true;
+  cerr << "could not read chunks from " << input << endl;
+  return false;
+}
+
+static bool SameOrder(const vector<Chunk>& chunks, const vector<uint32_t>& a,
+                      const vector<uint32_t>& b) {
+  for (size_t i = 0; i < a.size(); i++)
+    if (chunks[a[i]].timestamp_start != chunks[b[i]].timestamp_start)
+      return false;
+  return true;
+}
+
+static int BenchSort(const string& input, unsigned threads) {
+  vector<Chunk> chunks;
+  if (!ReadChunks(input, chunks)) return 1;
+  ThreadPool pool(threads);
+  size_t n = chunks.size();
+  cout << n << " chunks, " << pool.NumThreads() << " threads" << endl;
+
+  // how chunks were sorted before the permutation sorts, the packed
+  // structs in place
+  vector<Chunk> copy(chunks);
+  double packed = TimeMs([&copy]() {
+    sort(copy.begin(), copy.end(), [](const Chunk& a, const Chunk& b) {
+      return a.timestamp_start < b.timestamp_start;
+    });
+  });
+
+  const Chunk* c = chunks.data();
+  auto by_start = [c](uint32_t a, uint32_t b) {
+    return c[a].timestamp_start < c[b].timestamp_start;
+  };
+  vector<uint32_t> perm(n), par(n), radix;
+  for (size_t i = 0; i < n; i++) perm[i] = par[i] = i;
+  double indirect = TimeMs([&]() { sort(perm.begin(), perm.end(), by_start); });
+  double parallel = TimeMs([&]() { ParallelSort(pool, par, by_start); });
+  double radix_ms =
+      TimeMs([&]() { SortChunksByStart(pool, c, n, radix); });
+
+  cout << "std::sort packed chunks     " << packed << " ms" << endl;
+  cout << "std::sort permutation       " << indirect << " ms" << endl;
+  cout << "parallel sort permutation   " << parallel << " ms" << endl;
+  cout << "radix sort permutation      " << radix_ms << " ms" << endl;
+
+  if (!SameOrder(chunks, perm, par) || !SameOrder(chunks, perm, radix)) {
+    cerr << "sort results differ!" << endl;
+    return 1;
+  }
+  return 0;
+}
+
+// the pattern code as it was before the chunk store, over a vector of
+// pointers to the packed chunks of a trace, in start order. copied here
+// unchanged, so the fused scan is measured against what it replaced
+
+static float OldUsageScore(std::vector<Chunk*> const& chunks) {
+  double sum = 0;
+  uint64_t total_bytes = 0;
+  for (auto chunk : chunks) {
+    if (chunk->num_writes == 0 && chunk->num_reads == 0) {
+      continue;
+    }
+    sum += double(chunk->access_interval_high - chunk->access_interval_low);
+    total_bytes += chunk->size;
+  }
+  if (sum == 0){
+    return 0;
+  }
+  return float(sum) / float(total_bytes);
+}
+
+static float OldLifetimeScore(std::vector<Chunk*> const& chunks,
+                              uint64_t threshold) {
+  double current_lifetime_sum = 0;
+  uint32_t current_num_chunks = 0;
+  uint64_t region_start_time = chunks[0]->timestamp_start;
+  uint64_t region_end_time = chunks[0]->timestamp_end;
+  double region_score_total = 0;
+  uint32_t num_regions = 0;
+  Chunk* prev = nullptr;
+  for (auto chunk : chunks) {
+    if (prev != nullptr && chunk->timestamp_start - prev->timestamp_start > threshold) {
+      // finish this region
+      if (prev->timestamp_end > region_end_time) {
+        region_end_time = prev->timestamp_end;
+      }
+      uint64_t region_lifetime = region_end_time - region_start_time;
+      double chunk_avg_lifetime =
+          current_lifetime_sum / double(current_num_chunks);
+      region_score_total += chunk_avg_lifetime / double(region_lifetime);
+      num_regions++;
+
+      // start a new one
+      current_num_chunks = 0;
+      current_lifetime_sum = 0;
+      region_start_time = chunk->timestamp_start;
+      region_end_time = chunk->timestamp_end;
+    }
+    current_lifetime_sum += chunk->timestamp_end - chunk->timestamp_start;
+    current_num_chunks++;
+    if (chunk->timestamp_end > region_end_time) {
+      region_end_time = chunk->timestamp_end;
+    }
+    prev = chunk;
+  }
+
+  // finish up last region
+  if (prev->timestamp_end > region_end_time) {
+    region_end_time = prev->timestamp_end;
+  }
+  uint64_t region_lifetime = region_end_time - region_start_time;
+  double chunk_avg_lifetime = current_lifetime_sum / double(current_num_chunks);
+  region_score_total += chunk_avg_lifetime / double(region_lifetime);
+  num_regions++;
+
+  return region_score_total / num_regions;
+}
+
+static float OldUsefulLifetimeScore(std::vector<Chunk*> const& chunks) {
+  double score_sum = 0;
+  for (auto chunk : chunks) {
+    uint64_t total_life = chunk->timestamp_end - chunk->timestamp_start;
+    uint64_t active_life =
+        chunk->timestamp_last_access - chunk->timestamp_first_access;
+    score_sum += double(active_life) / double(total_life);
+  }
+  return score_sum / chunks.size();
+}
+
+static uint64_t OldDetect(std::vector<Chunk*> const& chunks,
+                          const PatternParams& params) {
+  uint64_t min_lifetime = UINT64_MAX;
+  unsigned int total_reads = 0, total_writes = 0;
+  bool has_early_alloc = false, has_late_free = false;
+  bool has_multi_thread = false;
+  bool has_low_access_coverage = false;
+  uint64_t last_size = 0;
+  unsigned int current_run = 0, longest_run = 0;
+
+  for (auto chunk : chunks) {
+    // min lifetime
+    uint64_t diff = chunk->timestamp_end - chunk->timestamp_start;
+    if (diff < min_lifetime) {
+      min_lifetime = diff;
+    }
+
+    // total reads, writes
+    total_reads += chunk->num_reads;
+    total_writes += chunk->num_writes;
+
+    // late free
+    if (chunk->timestamp_first_access - chunk->timestamp_start >
+        (chunk->timestamp_end - chunk->timestamp_start) / 2) {
+      has_early_alloc = true;
+    }
+
+    // early alloc
+    if (chunk->timestamp_end - chunk->timestamp_last_access >
+        (chunk->timestamp_end - chunk->timestamp_start) / 2) {
+      has_late_free = true;
+    }
+
+    // increasing alloc sizes
+    if (last_size == 0) {
+      last_size = chunk->size;
+      current_run++;
+    } else {
+      if (chunk->size >= last_size) {
+        last_size = chunk->size;
+        current_run++;
+      } else {
+        longest_run = current_run > longest_run ? current_run : longest_run;
+        current_run = 0;
+        last_size = chunk->size;
+      }
+    }
+    // multithread
+    if (bool(chunk->multi_thread)) {
+      has_multi_thread = true;
+    }
+
+    if (float(chunk->access_interval_high - chunk->access_interval_low) /
+            float(chunk->size) <
+        params.access_coverage) {
+      has_low_access_coverage = true;
+    }
+  }
+
+  uint64_t i = 0;
+  if (min_lifetime <= params.short_lifetime) {
+    i |= Inefficiency::ShortLifetime;
+  }
+  if (total_reads == 0 || total_writes == 0) {
+    if (total_writes > 0) {
+      i |= Inefficiency::WriteOnly;
+    } else if (total_reads > 0) {
+      i |= Inefficiency::ReadOnly;
+    } else {
+      i |= Inefficiency::Unused;
+    }
+  }
+
+  if (has_early_alloc) {
+    i |= Inefficiency::EarlyAlloc;
+  }
+  if (has_late_free) {
+    i |= Inefficiency::LateFree;
+  }
+
+  if (longest_run >= params.alloc_min_run) {
+    i |= Inefficiency::IncreasingReallocs;
+  }
+  if (has_multi_thread) {
+    i |= Inefficiency::MultiThread;
+  }
+  if (has_low_access_coverage) {
+    i |= Inefficiency::LowAccessCoverage;
+  }
+
+  return i;
+}
+
+// the original per trace pass: Detect, the three scores and the totals,
+// each chasing the chunk pointers again. bytes_total is new, it is summed
+// along with the alloc time
+static void OldFourPass(const vector<Chunk*>& chunks,
+                        const PatternParams& params, uint64_t threshold,
+                        TraceScan& scan) {
+  scan.inefficiencies = OldDetect(chunks, params);
+  scan.usage_score = OldUsageScore(chunks);
+  scan.lifetime_score = OldLifetimeScore(chunks, threshold);
+  scan.useful_lifetime_score = OldUsefulLifetimeScore(chunks);
+  scan.alloc_time_total = 0;
+  scan.bytes_total = 0;
+  for (auto c : chunks) {
+    scan.alloc_time_total += c->alloc_call_time;
+    scan.bytes_total += c->size;
+  }
+}
+
+// the same four passes over the chunk store, to tell the layout change
+// apart from the fusion
+static void FourPass(const ChunkStore& store, ChunkRange range,
+                     const PatternParams& params, uint64_t threshold,
+                     TraceScan& scan) {
+  scan.inefficiencies = Detect(store, range, params);
+  scan.usage_score = UsageScore(store, range);
+  scan.lifetime_score = LifetimeScore(store, range, threshold);
+  scan.useful_lifetime_score = UsefulLifetimeScore(store, range);
+  scan.alloc_time_total = 0;
+  scan.bytes_total = 0;
+  for (uint32_t i = range.begin; i < range.end; i++) {
+    scan.alloc_time_total += store.alloc_call_time[i];
+    scan.bytes_total += store.size[i];
+  }
+}
+
+static bool SameFloat(float a, float b) {
+  return a == b || (std::isnan(a) && std::isnan(b));
+}
+
+static bool SameScan(const TraceScan& a, const TraceScan& b) {
+  return a.inefficiencies == b.inefficiencies &&
+         a.alloc_time_total == b.alloc_time_total &&
+         a.bytes_total == b.bytes_total &&
+         SameFloat(a.usage_score, b.usage_score) &&
+         SameFloat(a.lifetime_score, b.lifetime_score) &&
+         SameFloat(a.useful_lifetime_score, b.useful_lifetime_score);
+}
+
+static int BenchPattern(const string& input) {
+  vector<Chunk> chunks;
+  if (!ReadChunks(input, chunks)) return 1;
+  ThreadPool pool(1);
+  uint32_t n = chunks.size();
+
+  // the layout Dataset::BuildStore gives the store, grouped by trace in
+  // start order
+  uint32_t num_traces = 0;
+  uint64_t max_time = 0;
+  for (auto& c : chunks) {
+    num_traces = max(num_traces, c.stack_index + 1);
+    max_time = max(max_time, c.timestamp_end);
+  }
+  vector<uint32_t> order;
+  SortChunksByStart(pool, chunks.data(), n, order);
+  vector<ChunkRange> ranges(num_traces);
+  for (auto& c : chunks) ranges[c.stack_index].end++;
+  uint32_t offset = 0;
+  for (auto& r : ranges) {
+    r.begin = offset;
+    offset += r.end;
+    r.end = r.begin;
+  }
+  vector<uint32_t> by_trace(n);
+  for (uint32_t i : order) by_trace[ranges[chunks[i].stack_index].end++] = i;
+  ChunkStore store;
+  store.Build(pool, chunks.data(), by_trace.data(), n);
+
+  // what the traces held before the store, pointers into the chunks
+  // sorted in place
+  vector<Chunk> sorted(n);
+  for (uint32_t i = 0; i < n; i++) sorted[i] = chunks[order[i]];
+  vector<vector<Chunk*>> pointers(num_traces);
+  for (auto& c : sorted) pointers[c.stack_index].push_back(&c);
+
+  PatternParams params;
+  uint64_t threshold = max_time * 0.01f;
+  vector<TraceScan> old(num_traces), four(num_traces), fused(num_traces);
+
+  // per trace timings, bucketed by trace size
+  const uint32_t bounds[] = {16, 1024, UINT32_MAX};
+  const char* names[] = {"< 16 chunks", "16 - 1023 chunks", ">= 1024 chunks"};
+  double old_ms[3] = {0}, four_ms[3] = {0}, fused_ms[3] = {0};
+  size_t traces[3] = {0}, bucket_chunks[3] = {0};
+  for (uint32_t t = 0; t < num_traces; t++) {
+    ChunkRange r = ranges[t];
+    if (r.empty()) continue;
+    int b = 0;
+    while (r.size() >= bounds[b]) b++;
+    traces[b]++;
+    bucket_chunks[b] += r.size();
+    old_ms[b] += TimeMs([&]() { OldFourPass(pointers[t], params, threshold, old[t]); });
+    four_ms[b] += TimeMs([&]() { FourPass(store, r, params, threshold, four[t]); });
+    fused_ms[b] += TimeMs([&]() { ScanTrace(store, r, params, threshold, fused[t]); });
+  }
+
+  cout << n << " chunks, " << num_traces << " traces" << endl;
+  double old_total = 0, four_total = 0, fused_total = 0;
+  for (int b = 0; b < 3; b++) {
+    if (traces[b] == 0) continue;
+    old_total += old_ms[b];
+    four_total += four_ms[b];
+    fused_total += fused_ms[b];
+    cout << names[b] << ": " << traces[b] << " traces" << endl;
+    const char* labels[] = {"original", "four pass store", "fused"};
+    const double* ms[] = {old_ms, four_ms, fused_ms};
+    for (int k = 0; k < 3; k++)
+      cout << "  " << labels[k] << " " << ms[k][b] * 1e6 / traces[b]
+           << " ns/trace (" << ms[k][b] * 1e6 / bucket_chunks[b]
+           << " ns/chunk)" << endl;
+  }
+  cout << "total: original " << old_total << " ms, four pass store "
+       << four_total << " ms, fused " << fused_total << " ms" << endl;
+
+  for (uint32_t t = 0; t < num_traces; t++) {
+    if (!SameScan(old[t], fused[t]) || !SameScan(four[t], fused[t])) {
+      cerr << "results differ for trace " << t << "!" << endl;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    cerr << "usage: " << argv[0]
+         << " sort|pattern <num chunks | file.chunks> [threads]" << endl;
+    return 1;
+  }
+  string mode(argv[1]);
+  unsigned threads = argc > 3 ? stoul(argv[3]) : thread::hardware_concurrency();
+  if (mode == "sort") return BenchSort(argv[2], threads);
+  if (mode == "pattern") return BenchPattern(argv[2]);
+  cerr << "unknown benchmark " << mode << endl;
+  return 1;
+}
@@ -3,7 +3,7 @@
   "targets": [
     {
       "target_name": "memoro",
-      "sources": [ "memoro.cc" , "memoro_node.cc", "pattern.cc", "stacktree.cc" ],
+      "sources": [ "memoro.cc" , "memoro_node.cc", "pattern.cc", "stacktree.cc", "frames.cc", "folded.cc", "cache.cc", "threadpool.cc", "radix.cc", "chunkstore.cc", "interval.cc", "aggregate.cc", "pyramid.cc", "diff.cc" ],
       "cflags": ["-Wall", "-std=c++14"],
       'cflags_cc!': ['-std=gnu++0x'],
       "xcode_settings": {
@@ -0,0 +1,235 @@
+//===-- cache.cc ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#include "cache.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace memoro {
+
+using namespace std;
+
+#define CACHE_VERSION 2
+#define CACHE_ALIGN 64ul
+#define KEY_SAMPLE_BYTES (64ul * 1024ul)
+
+static const char kCacheMagic[8] = {'M', 'E', 'M', 'O', 'R', 'O', 'C', '\0'};
+
+static uint64_t Fnv1a(const char* data, size_t len, uint64_t hash) {
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (uint8_t)data[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+static uint64_t Align(uint64_t offset) {
+  return (offset + CACHE_ALIGN - 1) & ~(CACHE_ALIGN - 1);
+}
+
+bool MakeFileKey(const string& path, FileKey& key) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  key.size = st.st_size;
+  key.mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+
+  vector<char> buf(KEY_SAMPLE_BYTES);
+  uint64_t hash = 14695981039346656037ull;
+  ssize_t n = pread(fd, &buf[0], buf.size(), 0);
+  if (n > 0) hash = Fnv1a(&buf[0], n, hash);
+  if (key.size > KEY_SAMPLE_BYTES) {
+    n = pread(fd, &buf[0], buf.size(), key.size - KEY_SAMPLE_BYTES);
+    if (n > 0) hash = Fnv1a(&buf[0], n, hash);
+  }
+  key.hash = hash;
+  close(fd);
+  return true;
+}
+
+static bool SameFileKey(const FileKey& a, const FileKey& b) {
+  return a.size == b.size && a.mtime == b.mtime && a.hash == b.hash;
+}
+
+static bool SameParams(const PatternParams& a, const PatternParams& b) {
+  return a.short_lifetime == b.short_lifetime &&
+         a.alloc_min_run == b.alloc_min_run && a.percentile == b.percentile &&
+         a.access_coverage == b.access_coverage;
+}
+
+DatasetCache::~DatasetCache() {
+  if (map_ != nullptr) munmap(map_, map_size_);
+}
+
+bool DatasetCache::Open(const string& path, const CacheKey& key,
+                        const PatternParams& params, uint64_t num_traces,
+                        uint64_t num_chunks) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CacheHeader)) {
+    close(fd);
+    return false;
+  }
+  void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return false;
+  map_ = static_cast<char*>(map);
+  map_size_ = st.st_size;
+
+  const CacheHeader* h = reinterpret_cast<const CacheHeader*>(map_);
+  if (memcmp(h->magic, kCacheMagic, sizeof(kCacheMagic)) != 0 ||
+      h->version != CACHE_VERSION || h->file_size != map_size_ ||
+      !SameFileKey(h->key.trace, key.trace) ||
+      !SameFileKey(h->key.chunk, key.chunk) || !SameParams(h->params, params) ||
+      h->num_traces != num_traces || h->num_chunks != num_chunks) {
+    cout << "cache " << path << " is stale, ignoring it" << endl;
+    return false;
+  }
+  bool valid =
+      h->traces_offset + num_traces * sizeof(CachedTrace) <= map_size_ &&
+      h->chunk_order_offset + num_chunks * sizeof(uint32_t) <= map_size_ &&
+      h->trace_chunks_offset + num_chunks * sizeof(uint32_t) <= map_size_ &&
+      h->points_offset + h->num_points * sizeof(TimeValue) <= map_size_;
+  const CachedTrace* traces =
+      reinterpret_cast<const CachedTrace*>(map_ + h->traces_offset);
+  for (uint64_t i = 0; valid && i < num_traces; i++) {
+    valid = traces[i].chunk_offset + traces[i].num_chunks <= num_chunks &&
+            traces[i].points_offset + traces[i].num_points <= h->num_points;
+  }
+  if (!valid) {
+    cout << "cache " << path << " is corrupt, ignoring it" << endl;
+    return false;
+  }
+
+  header_ = h;
+  return true;
+}
+
+const CachedTrace* DatasetCache::Traces() const {
+  return reinterpret_cast<const CachedTrace*>(map_ + header_->traces_offset);
+}
+
+const uint32_t* DatasetCache::ChunkOrder() const {
+  return reinterpret_cast<const uint32_t*>(map_ + header_->chunk_order_offset);
+}
+
+const uint32_t* DatasetCache::TraceChunks() const {
+  return reinterpret_cast<const uint32_t*>(map_ + header_->trace_chunks_offset);
+}
+
+const TimeValue* DatasetCache::Points() const {
+  return reinterpret_cast<const TimeValue*>(map_ + header_->points_offset);
+}
+
+// write len bytes at offset, zero padding whatever lies in between
+static bool WriteAt(FILE* f, uint64_t& pos, uint64_t offset, const void* data,
+                    size_t len) {
+  static const char zeros[CACHE_ALIGN] = {0};
+  if (offset > pos && fwrite(zeros, offset - pos, 1, f) != 1) return false;
+  pos = offset + len;
+  return len == 0 || fwrite(data, len, 1, f) == 1;
+}
+
+bool DatasetCache::Write(const string& path, const CacheKey& key,
+                         const PatternParams& params,
+                         const vector<Trace>& traces, const ChunkStore& store,
+                         const vector<uint32_t>& chunk_order,
+                         uint64_t max_time, uint64_t global_alloc_time) {
+  CacheHeader h = CacheHeader();
+  memcpy(h.magic, kCacheMagic, sizeof(kCacheMagic));
+  h.version = CACHE_VERSION;
+  h.key = key;
+  h.params = params;
+  h.num_traces = traces.size();
+  h.num_chunks = chunk_order.size();
+  h.max_time = max_time;
+  h.global_alloc_time = global_alloc_time;
+
+  vector<CachedTrace> cached(traces.size());
+  const AlignedVector<uint32_t>& trace_chunks = store.index;
+  uint64_t num_points = 0;
+  for (size_t i = 0; i < traces.size(); i++) {
+    const Trace& t = traces[i];
+    CachedTrace& c = cached[i];
+    c.chunk_offset = t.chunks.begin;
+    c.num_chunks = t.chunks.size();
+    c.points_offset = num_points;
+    c.num_points = t.aggregate.size();
+    c.max_aggregate = t.max_aggregate;
+    c.inefficiencies = t.inefficiencies;
+    c.alloc_time_total = t.alloc_time_total;
+    c.bytes_total = t.bytes_total;
+    c.usage_score = t.usage_score;
+    c.lifetime_score = t.lifetime_score;
+    c.useful_lifetime_score = t.useful_lifetime_score;
+    num_points += t.aggregate.size();
+  }
+  h.num_points = num_points;
+
+  h.traces_offset = Align(sizeof(CacheHeader));
+  h.chunk_order_offset =
+      Align(h.traces_offset + cached.size() * sizeof(CachedTrace));
+  h.trace_chunks_offset =
+      Align(h.chunk_order_offset + chunk_order.size() * sizeof(uint32_t));
+  h.points_offset =
+      Align(h.trace_chunks_offset + trace_chunks.size() * sizeof(uint32_t));
+  h.file_size = h.points_offset + num_points * sizeof(TimeValue);
+
+  string tmp_path = path + ".tmp";
+  FILE* f = fopen(tmp_path.c_str(), "w");
+  if (f == NULL) {
+    cout << "could not write cache " << tmp_path << endl;
+    return false;
+  }
+
+  uint64_t pos = 0;
+  bool ok = WriteAt(f, pos, 0, &h, sizeof(h)) &&
+            WriteAt(f, pos, h.traces_offset, cached.data(),
+                    cached.size() * sizeof(CachedTrace)) &&
+            WriteAt(f, pos, h.chunk_order_offset, chunk_order.data(),
+                    chunk_order.size() * sizeof(uint32_t)) &&
+            WriteAt(f, pos, h.trace_chunks_offset, trace_chunks.data(),
+                    trace_chunks.size() * sizeof(uint32_t));
+  for (size_t i = 0; ok && i < traces.size(); i++) {
+    const auto& points = traces[i].aggregate;
+    uint64_t offset =
+        h.points_offset + cached[i].points_offset * sizeof(TimeValue);
+    ok = WriteAt(f, pos, offset, points.data(),
+                 points.size() * sizeof(TimeValue));
+  }
+  // a zero length points section still has to reach its offset
+  ok = ok && WriteAt(f, pos, h.file_size, nullptr, 0);
+
+  if (fclose(f) != 0) ok = false;
+  if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    cout << "could not write cache " << path << endl;
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace memoro
@@ -0,0 +1,121 @@
+//===-- cache.h ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "chunkstore.h"
+#include "memoro.h"
+#include "pattern.h"
+
+namespace memoro {
+
+// Sidecar cache of what Dataset::Open derives from the chunks in
+// BuildStore, AggregateTraces and ScoreTraces (sort order, per trace chunk
+// lists, aggregates, scores and inefficiencies), so reopening the same
+// trace/chunk pair skips those steps.
+//
+// layout, every section 64 byte aligned so the file can be mmapped and
+// used in place:
+//   CacheHeader
+//   CachedTrace[num_traces]
+//   uint32_t chunk_order[num_chunks]   store positions by timestamp_start
+//   uint32_t trace_chunks[num_chunks]  chunk indexes grouped by trace, i.e.
+//                                      the ChunkStore layout
+//   TimeValue points[num_points]       per trace aggregates, back to back
+
+// identifies one input file. hashing multi GB files would defeat the
+// purpose, so the hash only covers the head and tail of the file
+struct FileKey {
+  uint64_t size = 0;
+  uint64_t mtime = 0;
+  uint64_t hash = 0;
+};
+
+struct CacheKey {
+  FileKey trace;
+  FileKey chunk;
+};
+
+struct CachedTrace {
+  uint64_t chunk_offset;  // into trace_chunks
+  uint64_t num_chunks;
+  uint64_t points_offset;  // into points
+  uint64_t num_points;
+  uint64_t max_aggregate;
+  uint64_t inefficiencies;
+  uint64_t alloc_time_total;
+  uint64_t bytes_total;
+  float usage_score;
+  float lifetime_score;
+  float useful_lifetime_score;
+  uint32_t pad;
+};
+
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t pad;
+  CacheKey key;
+  PatternParams params;
+  uint64_t num_traces;
+  uint64_t num_chunks;
+  uint64_t num_points;
+  uint64_t max_time;
+  uint64_t global_alloc_time;
+  uint64_t traces_offset;
+  uint64_t chunk_order_offset;
+  uint64_t trace_chunks_offset;
+  uint64_t points_offset;
+  uint64_t file_size;
+};
+
+bool MakeFileKey(const std::string& path, FileKey& key);
+
+class DatasetCache {
+ public:
+  DatasetCache() = default;
+  DatasetCache(const DatasetCache&) = delete;
+  DatasetCache& operator=(const DatasetCache&) = delete;
+  ~DatasetCache();
+
+  // map the cache at path, returns false if it does not exist or
+  // was built from different inputs
+  bool Open(const std::string& path, const CacheKey& key,
+            const PatternParams& params, uint64_t num_traces,
+            uint64_t num_chunks);
+
+  const CacheHeader& Header() const { return *header_; }
+  const CachedTrace* Traces() const;
+  const uint32_t* ChunkOrder() const;
+  const uint32_t* TraceChunks() const;
+  const TimeValue* Points() const;
+
+  // write a new cache for a fully loaded dataset. the file is written
+  // beside path and renamed into place, so readers never see half a cache
+  static bool Write(const std::string& path, const CacheKey& key,
+                    const PatternParams& params,
+                    const std::vector<Trace>& traces, const ChunkStore& store,
+                    const std::vector<uint32_t>& chunk_order, uint64_t max_time,
+                    uint64_t global_alloc_time);
+
+ private:
+  char* map_ = nullptr;
+  size_t map_size_ = 0;
+  const CacheHeader* header_ = nullptr;
+};
+
+}  // namespace memoro
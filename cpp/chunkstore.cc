@@ -0,0 +1,101 @@
+//===-- chunkstore.cc ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#include "chunkstore.h"
+#include <algorithm>
+
+namespace memoro {
+
+using namespace std;
+
+// columns are filled in blocks this size, one block per pool task
+#define CHUNK_STORE_GRAIN 65536ul
+
+void ChunkStore::Build(ThreadPool& pool, const Chunk* chunks,
+                       const uint32_t* order, size_t num_chunks) {
+  size.resize(num_chunks);
+  timestamp_start.resize(num_chunks);
+  timestamp_end.resize(num_chunks);
+  timestamp_first_access.resize(num_chunks);
+  timestamp_last_access.resize(num_chunks);
+  alloc_call_time.resize(num_chunks);
+  access_interval_low.resize(num_chunks);
+  access_interval_high.resize(num_chunks);
+  stack_index.resize(num_chunks);
+  num_reads.resize(num_chunks);
+  num_writes.resize(num_chunks);
+  multi_thread.resize(num_chunks);
+  index.assign(order, order + num_chunks);
+
+  pool.ParallelFor(num_chunks, CHUNK_STORE_GRAIN,
+                   [this, chunks, order](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      const Chunk& c = chunks[order[i]];
+      size[i] = c.size;
+      timestamp_start[i] = c.timestamp_start;
+      timestamp_end[i] = c.timestamp_end;
+      timestamp_first_access[i] = c.timestamp_first_access;
+      timestamp_last_access[i] = c.timestamp_last_access;
+      alloc_call_time[i] = c.alloc_call_time;
+      access_interval_low[i] = c.access_interval_low;
+      access_interval_high[i] = c.access_interval_high;
+      stack_index[i] = c.stack_index;
+      num_reads[i] = c.num_reads;
+      num_writes[i] = c.num_writes;
+      multi_thread[i] = c.multi_thread;
+    }
+  });
+}
+
+size_t ChunkStore::Bytes() const {
+  return VectorBytes(size) + VectorBytes(timestamp_start) +
+         VectorBytes(timestamp_end) + VectorBytes(timestamp_first_access) +
+         VectorBytes(timestamp_last_access) + VectorBytes(alloc_call_time) +
+         VectorBytes(access_interval_low) + VectorBytes(access_interval_high) +
+         VectorBytes(stack_index) + VectorBytes(num_reads) +
+         VectorBytes(num_writes) + VectorBytes(multi_thread) +
+         VectorBytes(index);
+}
+
+void ChunkStore::Clear() {
+  // swap with empty columns so the memory is actually released
+  ChunkStore empty;
+  swap(size, empty.size);
+  swap(timestamp_start, empty.timestamp_start);
+  swap(timestamp_end, empty.timestamp_end);
+  swap(timestamp_first_access, empty.timestamp_first_access);
+  swap(timestamp_last_access, empty.timestamp_last_access);
+  swap(alloc_call_time, empty.alloc_call_time);
+  swap(access_interval_low, empty.access_interval_low);
+  swap(access_interval_high, empty.access_interval_high);
+  swap(stack_index, empty.stack_index);
+  swap(num_reads, empty.num_reads);
+  swap(num_writes, empty.num_writes);
+  swap(multi_thread, empty.multi_thread);
+  swap(index, empty.index);
+}
+
+SCAN_KERNEL
+static uint64_t Max(const uint64_t* column, ChunkRange range) {
+  uint64_t max = 0;
+  for (uint32_t i = range.begin; i < range.end; i++)
+    max = column[i] > max ? column[i] : max;
+  return max;
+}
+
+uint64_t ChunkStore::MaxTimestampEnd(ChunkRange range) const {
+  return Max(timestamp_end.data(), range);
+}
+
+}  // namespace memoro
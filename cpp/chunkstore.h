@@ -0,0 +1,106 @@
+//===-- chunkstore.h ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <stdlib.h>
+#include <cstdint>
+#include <new>
+#include <vector>
+#include "memoro.h"
+#include "threadpool.h"
+
+namespace memoro {
+
+#define CHUNK_STORE_ALIGN 64
+
+// the scan kernels over the columns are compiled for AVX2 and SSE4.2 as
+// well as the baseline and the best version is picked when the addon is
+// loaded. most of them compare 64 bit timestamps, which the baseline
+// x86-64 target cannot do in vector registers.
+#if defined(__x86_64__) && defined(__linux__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define SCAN_KERNEL __attribute__((target_clones("avx2", "sse4.2", "default")))
+#endif
+#endif
+#ifndef SCAN_KERNEL
+#define SCAN_KERNEL
+#endif
+
+// allocator for the column arrays, so every column starts on a cache line
+// and vector loads in the scan kernels never straddle one at the start
+template <typename T>
+struct AlignedAllocator {
+  using value_type = T;
+
+  AlignedAllocator() = default;
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    void* p = nullptr;
+    if (posix_memalign(&p, CHUNK_STORE_ALIGN, n * sizeof(T)) != 0)
+      throw std::bad_alloc();
+    return static_cast<T*>(p);
+  }
+  void deallocate(T* p, size_t) { free(p); }
+
+  template <typename U>
+  bool operator==(const AlignedAllocator<U>&) const { return true; }
+  template <typename U>
+  bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Columnar copy of the chunk file, one array per Chunk field.
+//
+// Chunks are laid out grouped by trace and sorted by timestamp_start
+// within each trace, so the chunks of a trace are the contiguous range
+// Trace::chunks in every column. Scans that only need a couple of fields
+// (scores, pattern detection, aggregation) then read just those columns,
+// with unit stride, which the compiler can vectorize.
+// The packed Chunk array stays mapped for exporting whole chunks to JS,
+// index maps a store position back to it.
+class ChunkStore {
+ public:
+  // copy chunks[order[i]] to position i of every column
+  void Build(ThreadPool& pool, const Chunk* chunks, const uint32_t* order,
+             size_t num_chunks);
+  void Clear();
+
+  size_t Size() const { return index.size(); }
+  size_t Bytes() const;
+
+  uint64_t MaxTimestampEnd(ChunkRange range) const;
+
+  AlignedVector<uint64_t> size;
+  AlignedVector<uint64_t> timestamp_start;
+  AlignedVector<uint64_t> timestamp_end;
+  AlignedVector<uint64_t> timestamp_first_access;
+  AlignedVector<uint64_t> timestamp_last_access;
+  AlignedVector<uint64_t> alloc_call_time;
+  AlignedVector<uint32_t> access_interval_low;
+  AlignedVector<uint32_t> access_interval_high;
+  AlignedVector<uint32_t> stack_index;
+  AlignedVector<uint8_t> num_reads;
+  AlignedVector<uint8_t> num_writes;
+  AlignedVector<uint8_t> multi_thread;
+
+  // index of each chunk in the chunk file
+  AlignedVector<uint32_t> index;
+};
+
+}  // namespace memoro
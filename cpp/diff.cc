@@ -0,0 +1,346 @@
+//===-- diff.cc ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#include "diff.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <iostream>
+#include <unordered_map>
+#include "stacktree.h"
+
+namespace memoro {
+
+using namespace std;
+using namespace v8;
+
+// frames and traces per task
+#define DIFF_GRAIN 1024ul
+
+static bool IsNumber(const string& s, size_t begin, size_t end) {
+  if (begin >= end) return false;
+  for (size_t i = begin; i < end; i++)
+    if (!isdigit((unsigned char)s[i])) return false;
+  return true;
+}
+
+// "function file:line:col" -> "function file:line", the column moves with
+// unrelated edits to the line
+static string NormalizeName(const string& name) {
+  size_t col = name.rfind(':');
+  if (col == string::npos || !IsNumber(name, col + 1, name.size()))
+    return name;
+  size_t line = name.rfind(':', col - 1);
+  if (line == string::npos || !IsNumber(name, line + 1, col)) return name;
+  return name.substr(0, col);
+}
+
+// ids of the normalized names of frames, shared by both captures
+static void NameIds(ThreadPool& pool, const FrameTable& frames,
+                    unordered_map<string, uint32_t>& ids,
+                    vector<string>& names, vector<uint32_t>& name_of) {
+  vector<string> normal(frames.Size());
+  pool.ParallelFor(normal.size(), DIFF_GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++)
+      normal[i] = NormalizeName(frames.Get(i).name);
+  });
+
+  name_of.resize(normal.size());
+  for (size_t i = 0; i < normal.size(); i++) {
+    auto it = ids.find(normal[i]);
+    if (it == ids.end()) {
+      it = ids.emplace(normal[i], names.size()).first;
+      names.push_back(move(normal[i]));
+    }
+    name_of[i] = it->second;
+  }
+}
+
+// the node at the end of the path of t, adding what is missing
+static uint32_t Walk(const Trace& t, const vector<uint32_t>& name_of,
+                     EdgeMap& edges, vector<DiffNode>& nodes) {
+  uint32_t node = 0;
+  for (uint32_t f : t.frames) {
+    uint32_t name = name_of[f];
+    uint32_t child = edges.Find(node, name);
+    if (child == NO_NODE) {
+      child = nodes.size();
+      edges.Insert(node, name, child);
+      DiffNode n;
+      n.name = name;
+      n.parent = node;
+      n.next_sibling = nodes[node].first_child;
+      nodes[node].first_child = child;
+      nodes.push_back(n);
+    }
+    node = child;
+  }
+  return node;
+}
+
+static void AddTrace(DiffSide& side, const Trace& t, int index) {
+  if (side.trace_index == NO_TRACE) side.trace_index = index;
+  uint64_t n = t.chunks.size();
+  uint64_t total = side.num_chunks + n;
+  if (total > 0) {
+    side.usage_score =
+        (side.usage_score * side.num_chunks + t.usage_score * n) / total;
+    side.lifetime_score =
+        (side.lifetime_score * side.num_chunks + t.lifetime_score * n) / total;
+    side.useful_lifetime_score = (side.useful_lifetime_score * side.num_chunks +
+                                  t.useful_lifetime_score * n) /
+                                 total;
+  }
+  side.num_traces++;
+  side.max_aggregate += t.max_aggregate;
+  side.num_chunks = total;
+  side.alloc_time_total += t.alloc_time_total;
+  side.bytes_total += t.bytes_total;
+  side.inefficiencies |= t.inefficiencies;
+}
+
+// walk the traces of one capture into the tree, merging them into the
+// rows of their end nodes
+static void AddCapture(ThreadPool& pool, const vector<Trace>& traces,
+                       const vector<uint32_t>& name_of,
+                       const function<double(const Trace* t)>& f, bool after,
+                       EdgeMap& edges, vector<uint32_t>& row_of,
+                       DatasetDiff& diff) {
+  vector<double> values(traces.size());
+  pool.ParallelFor(traces.size(), DIFF_GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) values[i] = f(&traces[i]);
+  });
+
+  for (size_t i = 0; i < traces.size(); i++) {
+    const Trace& t = traces[i];
+    uint32_t node = Walk(t, name_of, edges, diff.nodes);
+    if (row_of.size() < diff.nodes.size())
+      row_of.resize(diff.nodes.size(), NO_NODE);
+    if (row_of[node] == NO_NODE) {
+      row_of[node] = diff.traces.size();
+      diff.traces.emplace_back();
+      diff.traces.back().node = node;
+    }
+    TraceDiff& row = diff.traces[row_of[node]];
+    if (after) {
+      AddTrace(row.b, t, i);
+      row.value_b += values[i];
+      diff.nodes[node].b += values[i];
+    } else {
+      AddTrace(row.a, t, i);
+      row.value_a += values[i];
+      diff.nodes[node].a += values[i];
+    }
+  }
+}
+
+static void SetDeltas(TraceDiff& d) {
+  d.max_aggregate_delta = int64_t(d.b.max_aggregate - d.a.max_aggregate);
+  d.num_chunks_delta = int64_t(d.b.num_chunks - d.a.num_chunks);
+  d.alloc_time_delta = int64_t(d.b.alloc_time_total - d.a.alloc_time_total);
+  d.bytes_total_delta = int64_t(d.b.bytes_total - d.a.bytes_total);
+  bool both = d.a.num_traces > 0 && d.b.num_traces > 0;
+  d.usage_delta = both ? d.b.usage_score - d.a.usage_score : 0;
+  d.lifetime_delta = both ? d.b.lifetime_score - d.a.lifetime_score : 0;
+  d.useful_lifetime_delta =
+      both ? d.b.useful_lifetime_score - d.a.useful_lifetime_score : 0;
+  d.inefficiencies_added = d.b.inefficiencies & ~d.a.inefficiencies;
+  d.inefficiencies_removed = d.a.inefficiencies & ~d.b.inefficiencies;
+}
+
+void DiffTraces(ThreadPool& pool, const vector<Trace>& a,
+                const FrameTable& frames_a, const vector<Trace>& b,
+                const FrameTable& frames_b,
+                const function<double(const Trace* t)>& f,
+                DatasetDiff& diff) {
+  diff.names.clear();
+  diff.nodes.clear();
+  diff.traces.clear();
+
+  unordered_map<string, uint32_t> ids;
+  vector<uint32_t> name_of_a, name_of_b;
+  NameIds(pool, frames_a, ids, diff.names, name_of_a);
+  NameIds(pool, frames_b, ids, diff.names, name_of_b);
+
+  // the root has no frame
+  diff.nodes.emplace_back();
+  diff.nodes[0].name = NO_NODE;
+  diff.nodes[0].parent = NO_NODE;
+
+  EdgeMap edges;
+  edges.Clear(frames_a.Size() + frames_b.Size());
+  vector<uint32_t> row_of;
+  AddCapture(pool, a, name_of_a, f, false, edges, row_of, diff);
+  AddCapture(pool, b, name_of_b, f, true, edges, row_of, diff);
+
+  // children come after their parent, so one backward pass sums it all up
+  for (size_t i = diff.nodes.size() - 1; i > 0; i--) {
+    DiffNode& n = diff.nodes[i];
+    diff.nodes[n.parent].a += n.a;
+    diff.nodes[n.parent].b += n.b;
+  }
+
+  pool.ParallelFor(diff.traces.size(), DIFF_GRAIN,
+                   [&diff](size_t begin, size_t end) {
+                     for (size_t i = begin; i < end; i++)
+                       SetDeltas(diff.traces[i]);
+                   });
+  ParallelSort(pool, diff.traces, [](const TraceDiff& x, const TraceDiff& y) {
+    double dx = fabs(x.value_b - x.value_a), dy = fabs(y.value_b - y.value_a);
+    return dx > dy || (dx == dy && x.node < y.node);
+  });
+}
+
+struct DiffKeys {
+  Local<String> kId, kName, kValueA, kValueB, kDelta;
+  Local<String> kNumChildren, kChildren;
+  Local<String> kProcess, kOther, kOtherCount;
+};
+
+static DiffKeys MakeDiffKeys(Isolate* isolate) {
+  return {
+    String::NewFromUtf8(isolate, "id"),
+    String::NewFromUtf8(isolate, "name"),
+    String::NewFromUtf8(isolate, "value_a"),
+    String::NewFromUtf8(isolate, "value_b"),
+    String::NewFromUtf8(isolate, "delta"),
+
+    String::NewFromUtf8(isolate, "num_children"),
+    String::NewFromUtf8(isolate, "children"),
+
+    String::NewFromUtf8(isolate, "process"),
+    String::NewFromUtf8(isolate, "other"),
+    String::NewFromUtf8(isolate, "other_count"),
+  };
+}
+
+// the children rolled up into "other"
+struct DiffOther {
+  double a = 0;
+  double b = 0;
+  size_t count = 0;
+};
+
+// the top_k children of node that changed the most, largest change
+// first, the rest go to other. children at 0 in both are left out
+static void TopChildren(const DatasetDiff& diff, uint32_t node, size_t top_k,
+                        vector<uint32_t>& top, DiffOther& other) {
+  top.clear();
+  other = DiffOther();
+  for (uint32_t c = diff.nodes[node].first_child; c != NO_NODE;
+       c = diff.nodes[c].next_sibling)
+    if (diff.nodes[c].a != 0 || diff.nodes[c].b != 0) top.push_back(c);
+
+  auto larger = [&diff](uint32_t x, uint32_t y) {
+    double dx = fabs(diff.nodes[x].b - diff.nodes[x].a);
+    double dy = fabs(diff.nodes[y].b - diff.nodes[y].a);
+    return dx > dy || (dx == dy && x < y);
+  };
+  SelectTopK(top, top_k, larger, [&diff, &other](uint32_t c) {
+    other.a += diff.nodes[c].a;
+    other.b += diff.nodes[c].b;
+    other.count++;
+  });
+}
+
+static void SetValues(Isolate* isolate, Local<Object> obj, double a, double b,
+                      const DiffKeys& keys) {
+  obj->Set(keys.kValueA, Number::New(isolate, a));
+  obj->Set(keys.kValueB, Number::New(isolate, b));
+  obj->Set(keys.kDelta, Number::New(isolate, b - a));
+}
+
+static Local<Object> ObjectifyOther(Isolate* isolate, const DiffOther& other,
+                                    const DiffKeys& keys) {
+  Local<Object> obj = Object::New(isolate);
+  obj->Set(keys.kId, Number::New(isolate, -1));
+  obj->Set(keys.kName, keys.kOther);
+  SetValues(isolate, obj, other.a, other.b, keys);
+  obj->Set(keys.kNumChildren, Number::New(isolate, 0));
+  obj->Set(keys.kOtherCount, Number::New(isolate, other.count));
+  return obj;
+}
+
+static Local<Object> Objectify(Isolate* isolate, const DatasetDiff& diff,
+                               uint32_t node, const DiffKeys& keys,
+                               size_t top_k, size_t count, size_t depth) {
+  const DiffNode& n = diff.nodes[node];
+  Local<Object> obj = Object::New(isolate);
+  obj->Set(keys.kId, Number::New(isolate, node));
+  if (node == 0)
+    obj->Set(keys.kName, keys.kProcess);
+  else
+    obj->Set(keys.kName,
+             String::NewFromUtf8(isolate, diff.names[n.name].c_str()));
+  SetValues(isolate, obj, n.a, n.b, keys);
+
+  vector<uint32_t> top;
+  DiffOther other;
+  TopChildren(diff, node, top_k, top, other);
+  size_t num_children = top.size() + (other.count > 0);
+  obj->Set(keys.kNumChildren, Number::New(isolate, num_children));
+  // children left out are fetched with DiffTreeChildren
+  if (depth == 0) return obj;
+
+  auto children = ChildrenArray(
+      isolate, 0, min(count, num_children), [&](size_t i) {
+        if (i < top.size())
+          return Objectify(isolate, diff, top[i], keys, top_k, count,
+                           depth - 1);
+        return ObjectifyOther(isolate, other, keys);
+      });
+  obj->Set(keys.kChildren, children);
+  return obj;
+}
+
+Local<Object> DiffTreeObject(Isolate* isolate, const DatasetDiff& diff,
+                             size_t top_k, size_t count, size_t depth) {
+  const DiffKeys keys = MakeDiffKeys(isolate);
+  if (diff.nodes.empty()) {
+    Local<Object> root = Object::New(isolate);
+    root->Set(keys.kName, keys.kProcess);
+    SetValues(isolate, root, 0, 0, keys);
+    root->Set(keys.kChildren, Array::New(isolate));
+    return root;
+  }
+  return Objectify(isolate, diff, 0, keys, top_k, count, depth);
+}
+
+void DiffTreeChildren(const DatasetDiff& diff, size_t top_k,
+                      const FunctionCallbackInfo<Value>& args, int first) {
+  Isolate* isolate = args.GetIsolate();
+  const DiffKeys keys = MakeDiffKeys(isolate);
+  args.GetReturnValue().Set(Array::New(isolate));
+
+  double id = args[first]->NumberValue();
+  if (!(id >= 0 && id < diff.nodes.size())) {
+    cout << "DIFF NODE OUT OF RANGE\n";
+    return;
+  }
+
+  vector<uint32_t> top;
+  DiffOther other;
+  TopChildren(diff, uint32_t(id), top_k, top, other);
+  size_t offset, end;
+  if (!PageArgs(args, first + 1, top.size() + (other.count > 0), offset, end))
+    return;
+  args.GetReturnValue().Set(
+      ChildrenArray(isolate, offset, end, [&](size_t i) {
+        if (i < top.size())
+          return Objectify(isolate, diff, top[i], keys, top_k, 0, 0);
+        return ObjectifyOther(isolate, other, keys);
+      }));
+}
+
+}  // namespace memoro
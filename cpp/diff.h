@@ -0,0 +1,118 @@
+//===-- diff.h ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <v8.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "frames.h"
+#include "memoro.h"
+#include "threadpool.h"
+
+namespace memoro {
+
+// no trace on one side of a TraceDiff
+#define NO_TRACE -1
+
+// the traces of one capture with a call path, merged
+struct DiffSide {
+  int trace_index = NO_TRACE;  // the first of them
+  uint32_t num_traces = 0;
+  // summed
+  uint64_t max_aggregate = 0;
+  uint64_t num_chunks = 0;
+  uint64_t alloc_time_total = 0;
+  uint64_t bytes_total = 0;
+  uint64_t inefficiencies = 0;  // or'ed
+  // means weighted by the number of chunks
+  float usage_score = 0;
+  float lifetime_score = 0;
+  float useful_lifetime_score = 0;
+};
+
+// a call path in either capture, with after minus before
+struct TraceDiff {
+  uint32_t node;  // where the path ends in the DiffNode tree
+  DiffSide a;     // before
+  DiffSide b;     // after
+  int64_t max_aggregate_delta;
+  int64_t num_chunks_delta;
+  int64_t alloc_time_delta;
+  int64_t bytes_total_delta;
+  // 0 unless the path is in both captures
+  float usage_delta;
+  float lifetime_delta;
+  float useful_lifetime_delta;
+  uint64_t inefficiencies_added;    // in after only
+  uint64_t inefficiencies_removed;  // in before only
+  // metric f of DiffTraces for each side
+  double value_a = 0;
+  double value_b = 0;
+};
+
+// node of the differential stack tree, the call paths of both captures in
+// one tree. children come after their parent
+struct DiffNode {
+  uint32_t name;  // in DatasetDiff names
+  uint32_t parent;
+  uint32_t first_child = UINT32_MAX;
+  uint32_t next_sibling = UINT32_MAX;
+  // the metric summed over the traces below, per capture
+  double a = 0;
+  double b = 0;
+};
+
+struct DatasetDiff {
+  // normalized frame names, see DiffTraces
+  std::vector<std::string> names;
+  // node 0 is the root
+  std::vector<DiffNode> nodes;
+  // by the size of the change in the metric, largest first
+  std::vector<TraceDiff> traces;
+};
+
+// Differential analysis of two captures of the same program, before (a)
+// and after (b).
+//
+// traces are aligned by their normalized call path: the frame names,
+// "function file:line" without the column, and not the addresses, which
+// move between builds. traces of one capture that end up with the same
+// path are merged. the paths of both captures go into one tree, walking
+// it costs a hash probe per frame, and the per capture values of metric
+// f are summed up the tree. the tree is shared by all paths, so there is
+// no string work per trace, only per distinct frame.
+void DiffTraces(ThreadPool& pool, const std::vector<Trace>& a,
+                const FrameTable& frames_a, const std::vector<Trace>& b,
+                const FrameTable& frames_b,
+                const std::function<double(const Trace* t)>& f,
+                DatasetDiff& diff);
+
+// the tree of diff as JS objects {id, name, value_a, value_b, delta,
+// num_children, children}, like the stack tree: limited to the count
+// children of each node that changed the most and depth levels below the
+// root, SIZE_MAX for all. children past the top_k of a node go to an
+// "other" node
+v8::Local<v8::Object> DiffTreeObject(v8::Isolate* isolate,
+                                     const DatasetDiff& diff, size_t top_k,
+                                     size_t count, size_t depth);
+// args (node id, offset, count) from args[first] on, a page of the
+// children of a node
+void DiffTreeChildren(const DatasetDiff& diff, size_t top_k,
+                      const v8::FunctionCallbackInfo<v8::Value>& args,
+                      int first);
+
+}  // namespace memoro
@@ -0,0 +1,96 @@
+//===-- folded.cc ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#include "folded.h"
+#include <cstdio>
+#include <unistd.h>
+
+namespace memoro {
+
+using namespace std;
+
+// traces formatted per task, and tasks per thread between writes
+#define FOLDED_BLOCK 1024ul
+#define FOLDED_BLOCKS_PER_THREAD 4ul
+
+// ';' separates frames and the value follows the last space, so ';' and
+// line breaks can not appear in a name. spaces are fine
+static string CleanName(const string& name) {
+  string clean = name;
+  for (auto& c : clean)
+    if (c == ';') c = ':';
+    else if (c == '\n' || c == '\r') c = ' ';
+  return clean;
+}
+
+static void FormatTrace(const Trace& t, uint64_t value,
+                        const vector<string>& names, string& out) {
+  for (size_t d = 0; d < t.frames.size(); d++) {
+    if (d > 0) out += ';';
+    out += names[t.frames[d]];
+  }
+  char num[24];
+  int len = snprintf(num, sizeof(num), " %lu\n", (unsigned long)value);
+  out.append(num, len);
+}
+
+bool WriteFolded(ThreadPool& pool, const string& path,
+                 const vector<Trace>& traces, const FrameTable& frames,
+                 const function<uint64_t(const Trace* t)>& f, string& msg) {
+  vector<string> names(frames.Size());
+  for (size_t i = 0; i < names.size(); i++)
+    names[i] = CleanName(frames.Get(i).name);
+
+  FILE* out = fopen(path.c_str(), "w");
+  if (out == NULL) {
+    msg = "failed to open file " + path;
+    return false;
+  }
+
+  size_t blocks_per_round = pool.NumThreads() * FOLDED_BLOCKS_PER_THREAD;
+  size_t round = blocks_per_round * FOLDED_BLOCK;
+  vector<string> blocks(blocks_per_round);
+  bool ok = true;
+  for (size_t first = 0; ok && first < traces.size(); first += round) {
+    size_t last = min(first + round, traces.size());
+    size_t num_blocks = (last - first + FOLDED_BLOCK - 1) / FOLDED_BLOCK;
+    pool.ParallelFor(num_blocks, 1, [&](size_t begin, size_t end) {
+      for (size_t b = begin; b < end; b++) {
+        string& s = blocks[b];
+        s.clear();
+        size_t i = first + b * FOLDED_BLOCK;
+        size_t block_end = min(i + FOLDED_BLOCK, last);
+        for (; i < block_end; i++) {
+          const Trace& t = traces[i];
+          if (t.frames.empty()) continue;
+          uint64_t value = f(&t);
+          if (value != 0) FormatTrace(t, value, names, s);
+        }
+      }
+    });
+    for (size_t b = 0; ok && b < num_blocks; b++)
+      ok = blocks[b].empty() ||
+           fwrite(blocks[b].data(), blocks[b].size(), 1, out) == 1;
+  }
+
+  if (fclose(out) != 0) ok = false;
+  if (!ok) {
+    msg = "failed to write file " + path;
+    unlink(path.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace memoro
@@ -0,0 +1,42 @@
+//===-- folded.h ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "frames.h"
+#include "memoro.h"
+#include "threadpool.h"
+
+namespace memoro {
+
+// Export of the traces in the collapsed stack format read by flame graph
+// tools, one line per trace with frames outermost first and its value:
+//
+//   main test.cpp:57;foo test.cpp:12;malloc 1024
+//
+// tools sum up equal stacks, so there is no need to build the stack tree.
+// traces are formatted in parallel, a block of them per task, and the
+// blocks written in order, so memory stays bounded by a few blocks no
+// matter how many traces there are. traces without frames or with a value
+// of 0 are left out.
+bool WriteFolded(ThreadPool& pool, const std::string& path,
+                 const std::vector<Trace>& traces, const FrameTable& frames,
+                 const std::function<uint64_t(const Trace* t)>& f,
+                 std::string& msg);
+
+}  // namespace memoro
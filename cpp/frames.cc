@@ -0,0 +1,71 @@
+//===-- frames.cc ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#include "frames.h"
+#include <stdlib.h>
+#include <algorithm>
+#include "memoro.h"
+
+namespace memoro {
+
+using namespace std;
+
+uint32_t FrameTable::Intern(const string& name, uint64_t addr) {
+  auto it = ids_.emplace(make_pair(name, addr), uint32_t(frames_.size()));
+  if (it.second) frames_.push_back({name, addr});
+  return it.first->second;
+}
+
+size_t FrameTable::Bytes() const {
+  size_t bytes = VectorBytes(frames_);
+  // every name is kept twice, in the frame and in its key
+  for (auto& f : frames_) bytes += 2 * f.name.capacity();
+  bytes += ids_.bucket_count() * sizeof(void*) +
+           ids_.size() * (sizeof(void*) + sizeof(decltype(ids_)::value_type));
+  return bytes;
+}
+
+void FrameTable::Clear() {
+  frames_.clear();
+  ids_.clear();
+}
+
+void ParseTrace(const string& trace, FrameTable& table,
+                vector<uint32_t>& path) {
+  path.clear();
+  string name;
+  auto position = find(trace.rbegin(), trace.rend(), '#');
+
+  // frames are listed innermost first, walk them backward
+  // #27 0x118b1a035  (<unknown module>)|
+  while (position != trace.rend()) {
+    size_t pos = trace.rend() - position;  // backward :-P
+    size_t p1 = trace.find_first_of(' ', pos);
+    size_t p2 = trace.find_first_of(' ', p1 + 1);
+    uint64_t addr = strtoull(trace.c_str() + p1 + 1, nullptr, 16);
+    if (trace[p2 + 2] == '(')
+      name = "unknown";  // unknown module
+    else {
+      p1 = trace.find_first_of(' ', p2 + 1);
+      p2 = trace.find_first_of('|', p1 + 1);
+      name = trace.substr(p1 + 1, p2 - p1 - 1);
+    }
+
+    path.push_back(table.Intern(name, addr));
+
+    position = find(position + 1, trace.rend(), '#');
+  }
+}
+
+}  // namespace memoro
@@ -0,0 +1,63 @@
+//===-- frames.h ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace memoro {
+
+// one stack frame, as symbolized in the trace file
+struct Frame {
+  std::string name;  // "function file:line", or "unknown" for no module
+  uint64_t addr;
+};
+
+// every distinct frame of the dataset once, so traces can be kept as
+// paths of frame ids and compared as integers
+class FrameTable {
+ public:
+  // id of the frame, adding it if it is new
+  uint32_t Intern(const std::string& name, uint64_t addr);
+
+  const Frame& Get(uint32_t id) const { return frames_[id]; }
+  size_t Size() const { return frames_.size(); }
+  void Clear();
+  // roughly, the map nodes are estimated
+  size_t Bytes() const;
+
+ private:
+  struct KeyHash {
+    size_t operator()(const std::pair<std::string, uint64_t>& k) const {
+      return std::hash<std::string>()(k.first) ^
+             (std::hash<uint64_t>()(k.second) * 31);
+    }
+  };
+
+  std::vector<Frame> frames_;
+  std::unordered_map<std::pair<std::string, uint64_t>, uint32_t, KeyHash>
+      ids_;
+};
+
+// parse a trace string of the form
+//   #1 0x10be26858 in main test.cpp:57|#0 ...
+// into frame ids, outermost frame (e.g. main) first
+void ParseTrace(const std::string& trace, FrameTable& table,
+                std::vector<uint32_t>& path);
+
+}  // namespace memoro
@@ -0,0 +1,120 @@
+//===-- interval.cc ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#include "interval.h"
+#include <algorithm>
+#include "radix.h"
+
+namespace memoro {
+
+using namespace std;
+
+void IntervalIndex::Build(ThreadPool& pool, const ChunkStore& store,
+                          const vector<Trace>& traces,
+                          const vector<uint32_t>& order) {
+  size_t n = store.Size();
+  const uint64_t* end = store.timestamp_end.data();
+  max_end_.resize(n);
+  sorted_end_.resize(n);
+  pool.ParallelFor(traces.size(), 16, [&](size_t begin, size_t last) {
+    for (size_t i = begin; i < last; i++) {
+      ChunkRange r = traces[i].chunks;
+      uint64_t running = 0;
+      for (uint32_t c = r.begin; c < r.end; c++) {
+        running = std::max(running, end[c]);
+        max_end_[c] = running;
+      }
+      copy(end + r.begin, end + r.end, sorted_end_.begin() + r.begin);
+      sort(sorted_end_.begin() + r.begin, sorted_end_.begin() + r.end);
+    }
+  });
+
+  start_order_ = order;
+  vector<uint64_t> keys(end, end + n);
+  end_order_.resize(n);
+  for (size_t i = 0; i < n; i++) end_order_[i] = i;
+  RadixSort(pool, keys, end_order_);
+}
+
+void IntervalIndex::Clear() {
+  IntervalIndex empty;
+  swap(max_end_, empty.max_end_);
+  swap(sorted_end_, empty.sorted_end_);
+  swap(start_order_, empty.start_order_);
+  swap(end_order_, empty.end_order_);
+}
+
+size_t IntervalIndex::Bytes() const {
+  return VectorBytes(max_end_) + VectorBytes(sorted_end_) +
+         VectorBytes(start_order_) + VectorBytes(end_order_);
+}
+
+ChunkRange IntervalIndex::Window(const ChunkStore& store, ChunkRange range,
+                                 uint64_t min, uint64_t max) const {
+  const uint64_t* start = store.timestamp_start.data();
+  const uint64_t* max_end = max_end_.data();
+  ChunkRange w;
+  w.end = lower_bound(start + range.begin, start + range.end, max) - start;
+  w.begin = upper_bound(max_end + range.begin, max_end + w.end, min) - max_end;
+  return w;
+}
+
+uint32_t IntervalIndex::CountLive(const ChunkStore& store, ChunkRange range,
+                                  uint64_t min, uint64_t max) const {
+  if (min >= max) return 0;
+  const uint64_t* start = store.timestamp_start.data();
+  const uint64_t* sorted_end = sorted_end_.data();
+  uint32_t started =
+      lower_bound(start + range.begin, start + range.end, max) - start;
+  // a chunk ending by min also started before max
+  uint32_t ended =
+      upper_bound(sorted_end + range.begin, sorted_end + range.end, min) -
+      sorted_end;
+  return started > ended ? started - ended : 0;
+}
+
+// first and one past the last of the positions in order whose column
+// value lies in [min, max]
+static pair<size_t, size_t> Between(const vector<uint32_t>& order,
+                                    const uint64_t* column, uint64_t min,
+                                    uint64_t max) {
+  auto first = lower_bound(
+      order.begin(), order.end(), min,
+      [column](uint32_t c, uint64_t t) { return column[c] < t; });
+  auto last = upper_bound(
+      first, order.end(), max,
+      [column](uint64_t t, uint32_t c) { return t < column[c]; });
+  return {first - order.begin(), last - order.begin()};
+}
+
+size_t IntervalIndex::CountLive(const ChunkStore& store, uint64_t min,
+                                uint64_t max) const {
+  if (min >= max) return 0;
+  size_t started =
+      Between(start_order_, store.timestamp_start.data(), 0, max - 1).second;
+  size_t ended = Between(end_order_, store.timestamp_end.data(), 0, min).second;
+  return started > ended ? started - ended : 0;
+}
+
+void IntervalIndex::Changed(const ChunkStore& store, uint64_t min,
+                            uint64_t max, vector<uint32_t>& positions) const {
+  auto starts = Between(start_order_, store.timestamp_start.data(), min, max);
+  auto ends = Between(end_order_, store.timestamp_end.data(), min, max);
+  positions.insert(positions.end(), start_order_.begin() + starts.first,
+                   start_order_.begin() + starts.second);
+  positions.insert(positions.end(), end_order_.begin() + ends.first,
+                   end_order_.begin() + ends.second);
+}
+
+}  // namespace memoro
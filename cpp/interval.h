@@ -0,0 +1,79 @@
+//===-- interval.h ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "chunkstore.h"
+#include "memoro.h"
+#include "threadpool.h"
+
+namespace memoro {
+
+// Index over the chunk lifetimes [timestamp_start, timestamp_end) for time
+// window queries, per trace and over the whole dataset. a chunk is live in
+// the window (min, max) if it starts before max and ends after min.
+//
+// within a trace the store keeps chunks sorted by start, so the chunks
+// starting before max are a prefix found by binary search. next to that
+// the index keeps two columns in store order: the running max of
+// timestamp_end within each trace, so the first chunk that can still be
+// live at min is a binary search too, and the ends of each trace sorted,
+// since the chunks of the prefix that are not live are exactly those
+// ending by min. globally it keeps the store positions sorted by start
+// and by end. every query is then O(log n) in the number of chunks.
+class IntervalIndex {
+ public:
+  // order holds the store positions sorted by timestamp_start
+  void Build(ThreadPool& pool, const ChunkStore& store,
+             const std::vector<Trace>& traces,
+             const std::vector<uint32_t>& order);
+  void Clear();
+  size_t Bytes() const;
+
+  // true if any chunk in range is live in (min, max)
+  bool Overlaps(const ChunkStore& store, ChunkRange range, uint64_t min,
+                uint64_t max) const {
+    ChunkRange w = Window(store, range, min, max);
+    return w.begin < w.end;
+  }
+
+  // the smallest part of range holding every chunk that is live in
+  // (min, max). chunks in it that are not live all end by min
+  ChunkRange Window(const ChunkStore& store, ChunkRange range, uint64_t min,
+                    uint64_t max) const;
+
+  // number of chunks in range live in (min, max)
+  uint32_t CountLive(const ChunkStore& store, ChunkRange range, uint64_t min,
+                     uint64_t max) const;
+
+  // number of chunks of the whole dataset live in (min, max)
+  size_t CountLive(const ChunkStore& store, uint64_t min, uint64_t max) const;
+
+  // append the store positions of the chunks that start or end in
+  // [min, max], chunks doing both are appended twice
+  void Changed(const ChunkStore& store, uint64_t min, uint64_t max,
+               std::vector<uint32_t>& positions) const;
+
+ private:
+  // in store order, per trace
+  AlignedVector<uint64_t> max_end_;
+  AlignedVector<uint64_t> sorted_end_;
+  // whole dataset
+  std::vector<uint32_t> start_order_;
+  std::vector<uint32_t> end_order_;
+};
+
+}  // namespace memoro
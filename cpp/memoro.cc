@@ -15,18 +15,31 @@
 
 #include <dirent.h>
 #include "memoro.h"
+#include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <memory>
 #include <iostream>
-#include <queue>
+#include <mutex>
 #include <unordered_map>
 #include <vector>
+#include "aggregate.h"
+#include "cache.h"
+#include "chunkstore.h"
+#include "diff.h"
+#include "folded.h"
+#include "frames.h"
+#include "interval.h"
 #include "pattern.h"
+#include "pyramid.h"
+#include "radix.h"
 #include "stacktree.h"
+#include "threadpool.h"
 #include <string.h>
 #include <string>
 
@@ -34,34 +47,35 @@ namespace memoro {
 
 using namespace std;
 
-#define MAX_POINTS 700
-#define VERSION_MAJOR 0
-#define VERSION_MINOR 1
-
-struct __attribute__((packed)) Header {
-  uint8_t version_major = 0;
-  uint8_t version_minor = 1;
-  uint8_t compression_type = 0;
-  uint16_t segment_start = 0;
-  uint32_t index_size = 0;
-};
-
-bool operator<(const TimeValue& a, const TimeValue& b) {
-  return a.time > b.time;
-}
+// time bins for the aggregate series sent to the UI, each bin gives at
+// most 3 points (min, max, last)
+#define MAX_BINS 350
+// traces between load progress reports
+#define PROGRESS_STEP 4096
 
 class Dataset {
  public:
   Dataset() = default;
-  bool Reset(const string& dir_path, const string& trace_file, const string& chunk_file,
-             string& msg) {
-    if (chunk_ptr_ != nullptr) delete[] chunk_ptr_;
-    traces_.clear();
-    min_time_ = UINT64_MAX;
-    aggregates_.clear();
-    trace_filters_.clear();
-    global_alloc_time_ = 0;
+  ~Dataset() { UnmapChunks(); }
+
+  // load the files into this dataset, which is new and not shared yet.
+  // cancelled is polled between steps, once it returns true the load
+  // stops and fails with msg "cancelled"
+  bool Open(const string& dir_path, const string& trace_file,
+            const string& chunk_file, string& msg, const ProgressFn& progress,
+            const CancelFn& cancelled) {
+    progress_ = progress;
+    cancelled_ = cancelled;
+    bytes_read_ = 0;
+    bool result = Load(dir_path, trace_file, chunk_file, msg);
+    if (result) Progress(Done, 0, 0);
+    progress_ = nullptr;
+    cancelled_ = nullptr;
+    return result;
+  }
 
+  bool Load(const string& dir_path, const string& trace_file,
+            const string& chunk_file, string& msg) {
     if (!InitTypeData(dir_path, msg)) {
       return false;
     }
@@ -75,6 +89,7 @@ class Dataset {
     }
     Header header;
     fread(&header, sizeof(Header), 1, trace_fd);
+    bytes_read_ += sizeof(Header);
 
     if (header.version_major != VERSION_MAJOR ||
         header.version_minor != VERSION_MINOR) {
@@ -87,68 +102,84 @@ class Dataset {
     vector<uint16_t> index;
     index.resize(header.index_size);
     fread(&index[0], 2, header.index_size, trace_fd);
+    bytes_read_ += 2 * header.index_size;
 
     cout << "reading " << header.index_size << " traces" << endl;
 
-    traces_.reserve(header.index_size);
-    Trace t;
+    auto pool = WorkerPool();
+    cout << "using " << pool->NumThreads() << " worker threads" << endl;
+
+    traces_.resize(header.index_size);
     vector<char> trace_buf;  // used as a resizable buffer
     for (unsigned int i = 0; i < header.index_size; i++) {
       if (index[i] > trace_buf.size()) trace_buf.resize(index[i]);
 
       fread(&trace_buf[0], index[i], 1, trace_fd);
-      t.trace = string(&trace_buf[0], index[i]);
-
-      // now i admit, that this is indeed hacky, and entirely
-      // dependent on stack traces being produced by llvm-symbolizer
-      // or at least ending in dir/filename.cpp:<line>:<col>
-      // if/when we switch to symbolizing here, we will have more options
-      // and more robust code
-      size_t pos = t.trace.find_first_of("|");
-      size_t pos2 = t.trace.find_first_of("|", pos + 1);
-      if (pos != string::npos && pos2 != string::npos) {
-        pos = pos2;
-        while (t.trace[pos] != ' ') pos--;
-        string value = t.trace.substr(pos + 1, pos2 - pos - 1);
-        /* cout << "got value:" << value << endl; */
-        /* cout << "with mapped types: " << endl; */
-        auto range = type_map_.equal_range(value);
-        int position = 1000000000;  // should be max_int?
-        t.type = "";
-        for (auto ty = range.first; ty != range.second; ty++) {
-          cout << "(" << ty->second.first << ", " << ty->second.second << ")\n";
-          if (int p = t.trace.find(ty->second.first) != string::npos)
-            if (p < position) {
-              position = p;
-              t.type = ty->second.second;
-            }
+      traces_[i].trace = string(&trace_buf[0], index[i]);
+      bytes_read_ += index[i];
+      if (i % PROGRESS_STEP == 0) {
+        Progress(LoadData, i, traces_.size());
+        if (Cancelled(msg)) {
+          fclose(trace_fd);
+          return false;
         }
       }
-
-      /*auto ty = type_map_.find(value);
-      t.type = ty == type_map_.end() ? string("") : ty->second.second;*/
-      traces_.push_back(t);
     }
     fclose(trace_fd);
 
-    // for some reason I can't mmap the file so we open and copy ...
-    FILE* chunk_fd = fopen(chunk_file.c_str(), "r");
-    // file size produced by sanitizer is buggy and adds a bunch 0 data to
-    // end of file. not sure why yet ...
-    // int file_size = 0;
-    if (chunk_fd == NULL) {
+    Progress(Parsing, 0, traces_.size());
+    pool->ParallelFor(traces_.size(), 1024, [this](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) SetTraceType(traces_[i]);
+    });
+    types_.assign(1, string());
+    unordered_map<string, uint32_t> type_ids = {{string(), 0}};
+    for (auto& t : traces_) {
+      auto it = type_ids.emplace(t.type, types_.size());
+      if (it.second) types_.push_back(t.type);
+      t.type_id = it.first->second;
+    }
+    // once, the stack tree is built from the frame ids every time
+    for (size_t i = 0; i < traces_.size(); i++) {
+      ParseTrace(traces_[i].trace, frames_, traces_[i].frames);
+      if (i % PROGRESS_STEP == 0) {
+        Progress(Parsing, i, traces_.size());
+        if (Cancelled(msg)) return false;
+      }
+    }
+    cout << frames_.Size() << " distinct frames" << endl;
+
+    // map the chunk file read-only and use the packed chunks in place,
+    // so a load only pays for the pages that are actually touched
+    int chunk_fd = open(chunk_file.c_str(), O_RDONLY);
+    if (chunk_fd < 0) {
       msg = "failed to open file " + chunk_file;
       return false;
-    } /*else {
-      fseek(chunk_fd, 0L, SEEK_END);
-      file_size = ftell(chunk_fd);
-      rewind(chunk_fd);
-    }*/
+    }
+    struct stat chunk_stat;
+    if (fstat(chunk_fd, &chunk_stat) != 0) {
+      close(chunk_fd);
+      msg = "failed to stat file " + chunk_file;
+      return false;
+    }
+    size_t file_size = chunk_stat.st_size;
+    if (file_size < sizeof(Header)) {
+      close(chunk_fd);
+      msg = "File " + chunk_file + " is too small to be a chunk file";
+      return false;
+    }
+    void* map = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, chunk_fd, 0);
+    close(chunk_fd);
+    if (map == MAP_FAILED) {
+      msg = "failed to mmap file " + chunk_file;
+      return false;
+    }
+    chunk_map_ = static_cast<char*>(map);
+    chunk_map_size_ = file_size;
 
-    fread(&header, sizeof(Header), 1, chunk_fd);
+    memcpy(&header, chunk_map_, sizeof(Header));
     if (header.version_major != VERSION_MAJOR ||
         header.version_minor != VERSION_MINOR) {
-      msg = "Header version mismatch in " + trace_file +
+      msg = "Header version mismatch in " + chunk_file +
             ". \
                Is this a valid trace/chunk file?";
       return false;
@@ -156,69 +187,116 @@ class Dataset {
 
     cout << "reading " << header.index_size << " chunks" << endl;
 
-    index.resize(header.index_size);
-    fread(&index[0], 2, header.index_size, chunk_fd);
-
     num_chunks_ = header.index_size;
-    // file_size = file_size - sizeof(Header) - header.index_size*2;
-    // cout << " file size now " << file_size << endl;
-    chunk_ptr_ = new char[num_chunks_ * sizeof(Chunk)];
-    fread(chunk_ptr_, num_chunks_ * sizeof(Chunk), 1, chunk_fd);
+    size_t chunks_offset = sizeof(Header) + header.index_size * sizeof(uint16_t);
+    // file size produced by sanitizer is buggy and adds a bunch 0 data to
+    // end of file, so only require that the chunks we were promised are there
+    if (file_size < chunks_offset + (size_t)num_chunks_ * sizeof(Chunk)) {
+      msg = "File " + chunk_file + " is truncated, expected " +
+            to_string(num_chunks_) + " chunks";
+      return false;
+    }
 
     // we can do this because all the fields are the same size (structs)
-    chunks_ = (Chunk*)(chunk_ptr_);
-    fclose(chunk_fd);
+    chunks_ = reinterpret_cast<const Chunk*>(chunk_map_ + chunks_offset);
     cout << "done reading\n";
 
-    // sort the chunks makes bin/aggregate easier
-    cout << "sorting chunks..." << endl;
-    sort(chunks_, chunks_ + num_chunks_, [](Chunk& a, Chunk& b) {
-      return a.timestamp_start < b.timestamp_start;
-    });
-
-    // set trace structure pointers to their chunks
-    cout << "building structures..." << endl;
-    min_time_ = 0;
-    for (unsigned int i = 0; i < num_chunks_; i++) {
-      Trace& t = traces_[chunks_[i].stack_index];
-      t.chunks.push_back(&chunks_[i]);
-      if (chunks_[i].timestamp_end > max_time_)
-        max_time_ = chunks_[i].timestamp_end;
-    }
-    filter_min_time_ = 0;
-    filter_max_time_ = max_time_;
-
-    // populate chunk aggregate vectors
-    cout << "aggregating traces ..." << endl;
-    uint64_t total_alloc_time = 0;
-    for (auto& t : traces_) {
-      // aggregate data
-      Aggregate(t.aggregate, t.max_aggregate, t.chunks);
-      t.inefficiencies = Detect(t.chunks, pattern_params_);
-      t.usage_score = UsageScore(t.chunks);
-      t.lifetime_score = LifetimeScore(
-          t.chunks,
-          filter_max_time_ * 0.01f);  // 1 percent lifetime for region threshold
-      t.useful_lifetime_score = UsefulLifetimeScore(t.chunks);
-      for (auto c : t.chunks) {
-        total_alloc_time += c->alloc_call_time;
+    CacheKey cache_key;
+    bool have_key = MakeFileKey(trace_file, cache_key.trace) &&
+                    MakeFileKey(chunk_file, cache_key.chunk);
+    string cache_path = chunk_file + ".cache";
+    DatasetCache cache;
+    bool cached = have_key &&
+                  cache.Open(cache_path, cache_key, pattern_params_,
+                             traces_.size(), num_chunks_) &&
+                  LoadCache(cache);
+    if (cached)
+      cout << "loaded preprocessed data from " << cache_path << endl;
+    else
+      BuildStore();
+    bytes_read_ += (size_t)num_chunks_ * sizeof(Chunk);
+    if (Cancelled(msg)) return false;
+
+    Progress(Building, 0, 2);
+    interval_index_.Build(*pool, store_, traces_, chunk_order_);
+    trace_pyramids_.resize(traces_.size());
+    Progress(Building, 1, 2);
+    stack_tree_.SetTraces(traces_, frames_);
+    // leave this sort order until the user changes
+    aggregates_.reserve(num_chunks_ * 2);
+    if (Cancelled(msg)) return false;
+
+    if (!cached) AggregateTraces();
+    if (Cancelled(msg)) return false;
+    // the global timeline only needs the trace aggregates, so it is
+    // handed out before the scores are done
+    RefreshAggregate();
+    vector<TimeValue> timeline;
+    SampleMinMax(aggregates_, aggregate_pyramid_, filter_min_time_,
+                 filter_max_time_, MAX_BINS, timeline);
+    progress_timeline_ = &timeline;
+    Progress(Aggregating, traces_.size(), traces_.size());
+    progress_timeline_ = nullptr;
+
+    if (!cached) {
+      ScoreTraces();
+      // cut short, the scores must not go into the cache
+      if (Cancelled(msg)) return false;
+      if (have_key) {
+        cout << "writing cache " << cache_path << endl;
+        DatasetCache::Write(cache_path, cache_key, pattern_params_, traces_,
+                            store_, chunk_order_, max_time_,
+                            global_alloc_time_);
       }
-      t.alloc_time_total = total_alloc_time;
-      global_alloc_time_ += total_alloc_time;
-      total_alloc_time = 0;
-      // build the stack tree
     }
 
-    stack_tree_.SetTraces(traces_);
+    for (auto& t : traces_)
+      trace_bytes_ += t.trace.capacity() + t.type.capacity() +
+                      VectorBytes(t.frames) + VectorBytes(t.aggregate);
+    return true;
+  }
 
-    CalculatePercentilesChunk(traces_, pattern_params_);
-    CalculatePercentilesSize(traces_, pattern_params_);
-    // leave this sort order until the user changes
-    aggregates_.reserve(num_chunks_ * 2);
+  void Progress(LoadingState state, uint64_t items, uint64_t total) {
+    if (progress_)
+      progress_({state, items, total, bytes_read_, progress_timeline_});
+  }
+
+  bool Cancelled() const { return cancelled_ && cancelled_(); }
 
+  bool Cancelled(string& msg) const {
+    if (!Cancelled()) return false;
+    msg = "cancelled";
     return true;
   }
 
+  void SetTraceType(Trace& t) {
+    // now i admit, that this is indeed hacky, and entirely
+    // dependent on stack traces being produced by llvm-symbolizer
+    // or at least ending in dir/filename.cpp:<line>:<col>
+    // if/when we switch to symbolizing here, we will have more options
+    // and more robust code
+    size_t pos = t.trace.find_first_of("|");
+    size_t pos2 = t.trace.find_first_of("|", pos + 1);
+    if (pos != string::npos && pos2 != string::npos) {
+      pos = pos2;
+      while (t.trace[pos] != ' ') pos--;
+      string value = t.trace.substr(pos + 1, pos2 - pos - 1);
+      auto range = type_map_.equal_range(value);
+      int position = 1000000000;  // should be max_int?
+      t.type = "";
+      for (auto ty = range.first; ty != range.second; ty++) {
+        if (int p = t.trace.find(ty->second.first) != string::npos)
+          if (p < position) {
+            position = p;
+            t.type = ty->second.second;
+          }
+      }
+    }
+
+    /*auto ty = type_map_.find(value);
+    t.type = ty == type_map_.end() ? string("") : ty->second.second;*/
+  }
+
   bool InitTypeData(const string& dir_path, string& msg) {
     string dir(dir_path + "typefiles/");
     vector<string> files;
@@ -270,24 +348,183 @@ class Dataset {
     return true;
   }
 
-  void AggregateAll(vector<TimeValue>& values) {
+  // sort the mapped chunks and build the store and trace chunk ranges
+  void BuildStore() {
+    auto pool = WorkerPool();
+
+    // sort a permutation instead of the chunks themselves, the mapping is
+    // read only. makes bin/aggregate easier
+    cout << "sorting chunks..." << endl;
+    Progress(Sorting, 0, num_chunks_);
+    SortChunksByStart(*pool, chunks_, num_chunks_, chunk_order_);
+    Progress(Sorting, num_chunks_, num_chunks_);
+
+    // group the sorted chunks by trace, which is the column store layout,
+    // and turn chunk_order_ into store positions on the way
+    cout << "building structures..." << endl;
+    min_time_ = 0;
+    for (unsigned int i = 0; i < num_chunks_; i++)
+      traces_[chunks_[i].stack_index].chunks.end++;
+    uint32_t offset = 0;
+    for (auto& t : traces_) {
+      t.chunks.begin = offset;
+      offset += t.chunks.end;
+      t.chunks.end = t.chunks.begin;
+    }
+    vector<uint32_t> by_trace(num_chunks_);
+    for (unsigned int i = 0; i < num_chunks_; i++) {
+      uint32_t index = chunk_order_[i];
+      uint32_t position = traces_[chunks_[index].stack_index].chunks.end++;
+      by_trace[position] = index;
+      chunk_order_[i] = position;
+    }
+    store_.Build(*pool, chunks_, by_trace.data(), num_chunks_);
+    max_time_ = store_.MaxTimestampEnd({0, num_chunks_});
+    filter_min_time_ = 0;
+    filter_max_time_ = max_time_;
+  }
+
+  // per trace aggregates, traces are independent of each other so they
+  // are spread over the pool
+  void AggregateTraces() {
+    auto pool = WorkerPool();
+    cout << "aggregating traces ..." << endl;
+    atomic<size_t> done(0);
+    pool->ParallelFor(traces_.size(), 16, [this, &pool, &done](size_t begin, size_t end) {
+      if (Cancelled()) return;
+      for (size_t i = begin; i < end; i++) {
+        Trace& t = traces_[i];
+        uint32_t first = t.chunks.begin;
+        AggregateChunks(
+            store_, t.chunks.size(), [first](size_t i) { return first + i; },
+            *pool, t.aggregate, t.max_aggregate);
+      }
+      ReportBlock(Aggregating, done, end - begin);
+    });
+  }
+
+  // inefficiencies, scores and totals in one pass over the chunks of
+  // every trace
+  void ScoreTraces() {
+    auto pool = WorkerPool();
+    atomic<size_t> done(0);
+    pool->ParallelFor(traces_.size(), 16, [this, &done](size_t begin, size_t end) {
+      if (Cancelled()) return;
+      for (size_t i = begin; i < end; i++) {
+        Trace& t = traces_[i];
+        TraceScan scan;
+        ScanTrace(store_, t.chunks, pattern_params_,
+                  filter_max_time_ * 0.01f,  // 1 percent lifetime for region threshold
+                  scan);
+        t.inefficiencies = scan.inefficiencies;
+        t.usage_score = scan.usage_score;
+        t.lifetime_score = scan.lifetime_score;
+        t.useful_lifetime_score = scan.useful_lifetime_score;
+        t.alloc_time_total = scan.alloc_time_total;
+        t.bytes_total = scan.bytes_total;
+      }
+      ReportBlock(Scoring, done, end - begin);
+    });
+    if (Cancelled()) return;
+    for (auto& t : traces_) global_alloc_time_ += t.alloc_time_total;
+
+    CalculatePercentilesChunk(traces_, pattern_params_);
+    CalculatePercentilesSize(traces_, pattern_params_);
+  }
+
+  // count a block of traces as done from the pool, reporting every
+  // PROGRESS_STEP of them
+  void ReportBlock(LoadingState state, atomic<size_t>& done, size_t n) {
+    size_t before = done.fetch_add(n);
+    if (before / PROGRESS_STEP != (before + n) / PROGRESS_STEP)
+      Progress(state, before + n, traces_.size());
+  }
+
+  // fill in everything BuildStore, AggregateTraces and ScoreTraces would
+  // compute from a matching cache,
+  // returns false if the cache does not fit the mapped chunks
+  bool LoadCache(const DatasetCache& cache) {
+    const CacheHeader& header = cache.Header();
+    const CachedTrace* cached = cache.Traces();
+    const uint32_t* trace_chunks = cache.TraceChunks();
+    const TimeValue* points = cache.Points();
+
+    // everything is checked before the traces are touched, BuildStore
+    // starts from empty trace ranges when this fails
+    const uint32_t* order = cache.ChunkOrder();
+    for (uint32_t i = 0; i < num_chunks_; i++) {
+      if (order[i] >= num_chunks_ || trace_chunks[i] >= num_chunks_)
+        return false;
+    }
+    // trace ranges have to tile the store in order
+    uint64_t offset = 0;
+    for (size_t i = 0; i < traces_.size(); i++) {
+      if (cached[i].chunk_offset != offset ||
+          cached[i].num_chunks > num_chunks_ - offset)
+        return false;
+      offset += cached[i].num_chunks;
+    }
+    if (offset != num_chunks_) return false;
+    // aggregates as AggregateChunks makes them: {0, 0}, then a point per
+    // allocation and free in time order. UpdateAggregate and the binary
+    // searches over them rely on both
+    for (size_t i = 0; i < traces_.size(); i++) {
+      const CachedTrace& c = cached[i];
+      if (c.num_points != 2 * c.num_chunks + 1) return false;
+      const TimeValue* p = points + c.points_offset;
+      for (uint64_t j = 1; j < c.num_points; j++)
+        if (p[j].time < p[j - 1].time) return false;
+    }
+
+    chunk_order_.assign(order, order + num_chunks_);
+    for (size_t i = 0; i < traces_.size(); i++) {
+      Trace& t = traces_[i];
+      const CachedTrace& c = cached[i];
+      t.chunks.begin = c.chunk_offset;
+      t.chunks.end = c.chunk_offset + c.num_chunks;
+      t.aggregate.assign(points + c.points_offset,
+                         points + c.points_offset + c.num_points);
+      t.max_aggregate = c.max_aggregate;
+      t.inefficiencies = c.inefficiencies;
+      t.alloc_time_total = c.alloc_time_total;
+      t.bytes_total = c.bytes_total;
+      t.usage_score = c.usage_score;
+      t.lifetime_score = c.lifetime_score;
+      t.useful_lifetime_score = c.useful_lifetime_score;
+    }
+
+    store_.Build(*WorkerPool(), chunks_, trace_chunks, num_chunks_);
+
+    min_time_ = 0;
+    max_time_ = header.max_time;
+    filter_min_time_ = 0;
+    filter_max_time_ = max_time_;
+    global_alloc_time_ = header.global_alloc_time;
+    return true;
+  }
+
+  void AggregateAll(vector<TimeValue>& values, const CancelFn& cancelled) {
     // build aggregate structure
-    // bin via sampling into times and values arrays
+    // bin into times and values arrays keeping the peaks
     cout << "aggregating all ..." << endl;
-    if (aggregates_.empty())
-      Aggregate(aggregates_, max_aggregate_, chunks_, num_chunks_);
-    // cout << "done, sampling ..." << endl;
-    SampleValues(aggregates_, values);
-    // cout << "done" << endl;
+    if (!RefreshAggregate(cancelled)) return;
+    SampleMinMax(aggregates_, aggregate_pyramid_, filter_min_time_,
+                 filter_max_time_, MAX_BINS, values);
   }
 
   void AggregateTrace(vector<TimeValue>& values, int trace_index) {
     // build aggregate structure
-    // bin via sampling into times and values arrays
+    // bin into times and values arrays keeping the peaks
     Trace& t = traces_[trace_index];
-    // cout << "sampling trace ..." << endl;
-    SampleValues(t.aggregate, values);
-    // cout << "done, with " << values.size() << " values" << endl;
+    // pyramids of traces are only built once they are looked at, most
+    // never are
+    MinMaxPyramid& pyramid = trace_pyramids_[trace_index];
+    if (!pyramid.Built()) {
+      pyramid.Build(t.aggregate);
+      trace_pyramid_bytes_ += pyramid.Bytes();
+    }
+    SampleMinMax(t.aggregate, pyramid, filter_min_time_, filter_max_time_,
+                 MAX_BINS, values);
   }
 
   uint64_t MaxAggregate() { return max_aggregate_; }
@@ -304,14 +541,11 @@ class Dataset {
       }
     }
     trace_filters_.push_back(str);
-    bool filtered = false;
     for (auto& trace : traces_) {
       if (trace.trace.find(str) == string::npos) {
         trace.filtered = true;
-        filtered = true;
       }
     }
-    if (filtered) aggregates_.clear();
   }
 
   void SetTypeFilter(string const& str) {
@@ -331,45 +565,38 @@ class Dataset {
         }
       }
     }
-    // we assume *something* changed
-    aggregates_.clear();
   }
 
   void TraceFilterReset() {
-    if (!trace_filters_.empty()) aggregates_.clear();
     trace_filters_.clear();
     for (auto& trace : traces_) trace.filtered = false;
   }
 
   void TypeFilterReset() {
-    if (!type_filters_.empty()) aggregates_.clear();
     type_filters_.clear();
     for (auto& trace : traces_) trace.type_filtered = false;
   }
 
-  void Traces(vector<TraceValue>& traces) {
+  void Traces(vector<TraceValue>& traces, const CancelFn& cancelled) {
     // TODO TraceValue not really needed, could just pass pointers to Trace
     // and convert directly to V8 objects
     TraceValue tmp;
+    if (interval_index_.CountLive(store_, filter_min_time_, filter_max_time_) ==
+        0)
+      return;
     traces.reserve(traces_.size());
     for (int i = 0; i < traces_.size(); i++) {
+      if ((i & 0xfff) == 0 && cancelled && cancelled()) return;
       if (IsTraceFiltered(traces_[i])) continue;
 
-      tmp.trace = &traces_[i].trace;
       tmp.trace_index = i;
+      // chunk indexes count the chunks live in the time window
       tmp.chunk_index = 0;
-      bool overlaps = false;
-      for (auto& chunk : traces_[i].chunks) {
-        if (chunk->timestamp_start < filter_max_time_ &&
-            chunk->timestamp_end > filter_min_time_) {
-          overlaps = true;
-          break;
-        }
-      }
-      if (!overlaps) continue;
+      tmp.num_chunks = interval_index_.CountLive(
+          store_, traces_[i].chunks, filter_min_time_, filter_max_time_);
+      if (tmp.num_chunks == 0) continue;
 
-      tmp.num_chunks = traces_[i].chunks.size();
-      tmp.type = &traces_[i].type;
+      tmp.type_id = traces_[i].type_id;
       tmp.alloc_time_total = traces_[i].alloc_time_total;
       tmp.max_aggregate = traces_[i].max_aggregate;
       tmp.usage_score = traces_[i].usage_score;
@@ -379,25 +606,33 @@ class Dataset {
     }
   }
 
-  void TraceChunks(std::vector<Chunk*>& chunks, int trace_index,
+  // chunk_index counts the chunks of the trace live in the time window,
+  // in timestamp_start order
+  void TraceChunks(std::vector<Chunk>& chunks, int trace_index,
                    int chunk_index, int num_chunks) {
-    // TODO adjust indexing to account for time filtering
     chunks.reserve(num_chunks);
     if (trace_index >= traces_.size()) {
       cout << "TRACE INDEX OVER SIZE\n";
       return;
     }
     Trace& t = traces_[trace_index];
-    if (chunk_index >= t.chunks.size()) {
+    uint32_t live = interval_index_.CountLive(store_, t.chunks,
+                                              filter_min_time_, filter_max_time_);
+    if (chunk_index >= live) {
       cout << "CHUNK INDEX OVER SIZE\n";
       return;
     }
     int bound = chunk_index + num_chunks;
-    if (bound > t.chunks.size()) bound = t.chunks.size();
-    for (int i = chunk_index; i < bound; i++) {
-      cout << "interval low:" << t.chunks[i]->access_interval_low << "\n";
-      chunks.push_back(t.chunks[i]);
+    if (bound > live) bound = live;
+
+    uint32_t position = SeekLiveChunk(trace_index, chunk_index, live);
+    for (int i = chunk_index; i < bound; i++, position++) {
+      while (!IsLive(position)) position++;
+      chunks.push_back(chunks_[store_.index[position]]);
     }
+    // pages are asked for one after the other, the next one starts here
+    chunk_cursor_ = {trace_index, filter_min_time_, filter_max_time_,
+                     uint32_t(bound), position};
   }
 
   void SetFilterMinMax(uint64_t min, uint64_t max) {
@@ -413,24 +648,129 @@ class Dataset {
     filter_max_time_ = max_time_;
   }
 
+  void LiveBytesDelta(vector<TraceDelta>& deltas, uint64_t t1, uint64_t t2) {
+    // the live bytes of a trace can only differ if one of its aggregate
+    // points lies in between, and those are the starts and ends of its
+    // chunks
+    vector<uint32_t> changed;
+    interval_index_.Changed(store_, std::min(t1, t2), std::max(t1, t2),
+                            changed);
+    for (auto& c : changed) c = store_.stack_index[c];
+    sort(changed.begin(), changed.end());
+    changed.erase(unique(changed.begin(), changed.end()), changed.end());
+    for (uint32_t i : changed) {
+      const Trace* t = &traces_[i];
+      int64_t delta = LiveBytes(t, t2) - LiveBytes(t, t1);
+      if (delta != 0) deltas.push_back({int(i), delta});
+    }
+  }
+
+  const string& TraceText(int trace_index) {
+    return traces_[trace_index].trace;
+  }
+
+  const vector<string>& TypeNames() { return types_; }
+
   uint64_t Inefficiences(int trace_index) {
     return traces_[trace_index].inefficiencies;
   }
 
-  void StackTreeObject(const v8::FunctionCallbackInfo<v8::Value>& args) {
-    stack_tree_.V8Objectify(args);
+  void StackTreeObject(const v8::FunctionCallbackInfo<v8::Value>& args,
+                       int first) {
+    stack_tree_.V8Objectify(args, first);
+  }
+
+  void StackTreeChildren(const v8::FunctionCallbackInfo<v8::Value>& args,
+                         int first) {
+    stack_tree_.V8Children(args, first);
+  }
+
+  void SetStackTreeTopK(size_t k) { stack_tree_.SetTopK(k); }
+
+  void StackTreeAggregate(std::function<double(const Trace* t)> f,
+                          const CancelFn& cancelled) {
+    stack_tree_.Aggregate(f, cancelled);
+  }
+
+  bool ExportFolded(const string& path,
+                    const function<uint64_t(const Trace* t)>& f, string& msg) {
+    return WriteFolded(*WorkerPool(), path, traces_, frames_, f, msg);
+  }
+
+  // this dataset as before, after as after
+  void DiffWith(const Dataset& after,
+                const function<double(const Trace* t)>& f,
+                DatasetDiff& diff) const {
+    DiffTraces(*WorkerPool(), traces_, frames_, after.traces_, after.frames_, f,
+               diff);
+  }
+
+  // heap memory held, roughly. the mapped chunk file is left out, its
+  // pages are backed by the file and the kernel can drop them. cheap
+  // enough to measure again after every call that can grow the dataset
+  size_t Bytes() const {
+    return store_.Bytes() + interval_index_.Bytes() +
+           VectorBytes(chunk_order_) + VectorBytes(aggregates_) +
+           VectorBytes(aggregate_traces_) + aggregate_pyramid_.Bytes() +
+           VectorBytes(trace_pyramids_) + trace_pyramid_bytes_ +
+           VectorBytes(traces_) + trace_bytes_ + frames_.Bytes() +
+           stack_tree_.Bytes();
   }
 
-  void StackTreeAggregate(std::function<double(const Trace* t)> f) {
-    stack_tree_.Aggregate(f);
+  // what the user has set on the dataset, kept while it is evicted and
+  // set again once it is loaded back
+  struct View {
+    vector<string> trace_filters;
+    vector<string> type_filters;
+    uint64_t filter_min_time = 0;
+    uint64_t filter_max_time = 0;
+  };
+
+  View GetView() const {
+    return {trace_filters_, type_filters_, filter_min_time_, filter_max_time_};
+  }
+
+  void SetView(const View& view) {
+    for (auto& s : view.trace_filters) SetTraceFilter(s);
+    for (auto& s : view.type_filters) SetTypeFilter(s);
+    SetFilterMinMax(view.filter_min_time, view.filter_max_time);
   }
 
  private:
-  Chunk* chunks_;
+  // the mapped chunk file, only read when building the store and to
+  // export whole chunks
+  const Chunk* chunks_ = nullptr;
+  ChunkStore store_;
+  IntervalIndex interval_index_;
+  // where the last TraceChunks page ended: the store position of live
+  // chunk index of the trace in the window it was asked for
+  struct ChunkCursor {
+    int trace = -1;
+    uint64_t min = 0;
+    uint64_t max = 0;
+    uint32_t index = 0;
+    uint32_t position = 0;
+  } chunk_cursor_;
+  // store_ positions sorted by timestamp_start
+  vector<uint32_t> chunk_order_;
+  // global aggregate of the traces with in_aggregate set, kept up to
+  // date with the filters by RefreshAggregate
   vector<TimeValue> aggregates_;
-  uint32_t num_chunks_;
+  // trace of every aggregates_ point after the first
+  vector<uint32_t> aggregate_traces_;
+  MinMaxPyramid aggregate_pyramid_;
+  // built on first use, see AggregateTrace
+  vector<MinMaxPyramid> trace_pyramids_;
+  size_t trace_pyramid_bytes_ = 0;
+  // held by the strings and vectors of traces_, set once loaded
+  size_t trace_bytes_ = 0;
+  uint32_t num_chunks_ = 0;
   vector<Trace> traces_;
-  char* chunk_ptr_ = nullptr;
+  // distinct trace types, see TypeNames
+  vector<string> types_;
+  FrameTable frames_;
+  char* chunk_map_ = nullptr;
+  size_t chunk_map_size_ = 0;
   uint64_t min_time_ = UINT64_MAX;
   uint64_t max_time_ = 0;
   uint64_t max_aggregate_ = 0;
@@ -442,14 +782,61 @@ class Dataset {
 
   StackTree stack_tree_;
 
+  // of the load in progress
+  ProgressFn progress_;
+  CancelFn cancelled_;
+  uint64_t bytes_read_ = 0;
+  const vector<TimeValue>* progress_timeline_ = nullptr;
+
   vector<string> trace_filters_;
   vector<string> type_filters_;
-  priority_queue<TimeValue> queue_;
 
-  inline bool IsTraceFiltered(Trace const& t) {
+  inline bool IsTraceFiltered(Trace const& t) const {
     return t.filtered || t.type_filtered;
   }
 
+  inline bool IsLive(uint32_t position) const {
+    return store_.timestamp_start[position] < filter_max_time_ &&
+           store_.timestamp_end[position] > filter_min_time_;
+  }
+
+  // store position of live chunk index of a trace, live being how many
+  // the trace has in the window. the live chunks lie in the trace's index
+  // Window, when nothing else does the position is known right away.
+  // otherwise walk from the window start or from the cursor, whichever
+  // is closer, sequential pages only walk over their own chunks
+  uint32_t SeekLiveChunk(int trace_index, uint32_t index, uint32_t live) {
+    ChunkRange w = interval_index_.Window(store_, traces_[trace_index].chunks,
+                                          filter_min_time_, filter_max_time_);
+    if (w.size() == live) return w.begin + index;
+
+    uint32_t at = 0, position = w.begin;
+    const ChunkCursor& c = chunk_cursor_;
+    if (c.trace == trace_index && c.min == filter_min_time_ &&
+        c.max == filter_max_time_ &&
+        (c.index <= index ? index - c.index : c.index - index) < index) {
+      at = c.index;
+      position = c.position;
+    }
+    while (at > index) {
+      position--;
+      if (IsLive(position)) at--;
+    }
+    for (;; position++) {
+      if (!IsLive(position)) continue;
+      if (at == index) break;
+      at++;
+    }
+    return position;
+  }
+
+  void UnmapChunks() {
+    if (chunk_map_ != nullptr) munmap(chunk_map_, chunk_map_size_);
+    chunk_map_ = nullptr;
+    chunk_map_size_ = 0;
+    chunks_ = nullptr;
+  }
+
   int GetFiles(string dir, vector<string>& files) {
     DIR* dp;
     struct dirent* dirp;
@@ -465,247 +852,452 @@ class Dataset {
     return 0;
   }
 
-  // TODO sampling will miss max values that can be pretty stark sometimes
-  // probably need to make sure that particular MAX or MIN values appear in the
-  // sample
-  void SampleValues(const vector<TimeValue>& points,
-                    vector<TimeValue>& values) {
-    values.clear();
-    values.reserve(MAX_POINTS + 2);
-    // first, find the filtered interval
-    // cout << "points size is " << points.size() << endl;
-    unsigned int j = 0;
-    for (; j < points.size() && points[j].time < filter_min_time_; j++)
-      ;
-    int min = j;
-    j++;
-    // cout << "min " << min << " j now " << j << endl;
-    if (j == points.size()) {
-      // basically, there were no points inside the interval,
-      // so we set a straight line of the appropriate value during the filter
-      // interval
-      values.push_back({filter_min_time_, 0});
-      values.push_back({filter_min_time_ + 1, points[min - 1].value});
-      values.push_back({filter_max_time_ - 1, points[min - 1].value});
-      values.push_back({filter_max_time_, 0});
-      return;
+  // global aggregate over the chunks of all traces that pass the filters.
+  // if cancelled aggregates_ is left empty, to be aggregated again
+  bool AggregateVisible(const CancelFn& cancelled) {
+    auto pool = WorkerPool();
+    vector<uint32_t>& visible = ThreadAggregateScratch().chunks;
+    const uint32_t* stack_index = store_.stack_index.data();
+    visible.clear();
+    for (size_t i = 0; i < chunk_order_.size(); i++) {
+      if ((i & 0xffff) == 0 && cancelled && cancelled()) {
+        aggregates_.clear();
+        return false;
+      }
+      uint32_t c = chunk_order_[i];
+      if (!IsTraceFiltered(traces_[stack_index[c]])) visible.push_back(c);
     }
-    for (; j < points.size() && points[j].time <= filter_max_time_; j++)
-      ;
-    int max = j;
-    // cout << "max " << max << endl;
-    int num_points = max - min + 1;
-    if (num_points == 0 || num_points < 0) {
-      cout << "num points is buggy: num points " << num_points << endl;
-      return;
+    if (!AggregateChunks(
+            store_, visible.size(), [&visible](size_t i) { return visible[i]; },
+            *pool, aggregates_, max_aggregate_, &aggregate_traces_, cancelled))
+      return false;
+    for (auto& c : aggregate_traces_) c = stack_index[c];
+    for (auto& t : traces_) t.in_aggregate = !IsTraceFiltered(t);
+    return true;
+  }
+
+  // bring the global aggregate up to date with the filters. only traces
+  // that were filtered in or out since the last call are merged into or
+  // dropped from it, toggling a keyword does not aggregate everything
+  // again. false if cancelled, then the next call aggregates everything
+  bool RefreshAggregate(const CancelFn& cancelled = nullptr) {
+    if (aggregates_.empty()) {
+      if (!AggregateVisible(cancelled)) return false;
+      aggregate_pyramid_.Build(aggregates_);
+      return true;
     }
+    if (cancelled && cancelled()) return false;
+
+    vector<uint8_t> removed(traces_.size(), 0);
+    vector<TraceEvents> added;
+    size_t changed_points = 0;
+    bool changed = false;
+    for (uint32_t i = 0; i < traces_.size(); i++) {
+      Trace& t = traces_[i];
+      bool visible = !IsTraceFiltered(t);
+      if (visible == t.in_aggregate) continue;
+      changed = true;
+      changed_points += t.aggregate.size();
+      if (visible)
+        added.push_back({i, &t.aggregate});
+      else
+        removed[i] = 1;
+      t.in_aggregate = visible;
+    }
+    if (!changed) return true;
 
-    if (num_points > MAX_POINTS) {
-      // float bin_size = float(num_points) / float(MAX_POINTS);
-      values.push_back(
-          {filter_min_time_, points[min == 0 ? min : min - 1].value});
-      /*auto sz = points.size();
-      for (uint32_t i = 0; i < num_points; i++) {
-        // find max value in interval [min + i, min + i + bin_size]
-        const TimeValue* maxval = &points[min+i];
-        for (auto x = min + i; x < min + i + bin_size && x < sz; x++)
-          if (points[x].value > maxval->value) maxval = &points[x];
-        values.push_back(*maxval);
-        i += bin_size - 1;
-      }*/
-      // sample MAX POINTS points
-      float interval = (float)num_points / (float)MAX_POINTS;
-      int i = 0;
-      float index = 0.0f;
-      while (i < MAX_POINTS) {
-        int idx = (int)index + min;
-        if (idx >= points.size()) {
-          cout << "POSSIBLE BUG points size is " << points.size() << " idx is "
-               << idx << " interval is " << interval << endl;
-          break;
-        }
-        values.push_back(points[idx]);
-        index += interval;
-        i++;
-      }
+    // past some point sorting all chunks again is cheaper than sorting
+    // the changed events
+    if (changed_points > aggregates_.size() / 2) {
+      if (!AggregateVisible(cancelled)) return false;
     } else {
-      values.resize(max - min + 1);
-      values[0] = {filter_min_time_, points[min == 0 ? min : min - 1].value};
-      memcpy(&values[1], &points[min], sizeof(TimeValue) * (max - min));
-    }
-    // cout << "first value is " << values[0].value << " at time " <<
-    // values[0].time << endl;
-    if (values[values.size() - 1].time > filter_max_time_)
-      values[values.size() - 1].time = filter_max_time_;
-    else
-      values.push_back({filter_max_time_ > values[values.size() - 1].time
-                            ? filter_max_time_
-                            : points[points.size() - 1].time,
-                        values[values.size() - 1].value});
-
-    // cout << "values size is " << values.size() << endl;
+      UpdateAggregate(aggregates_, aggregate_traces_, removed, added,
+                      max_aggregate_);
+    }
+    aggregate_pyramid_.Build(aggregates_);
+    return true;
   }
+};
 
-  void Aggregate(vector<TimeValue>& points, uint64_t& max_aggregate,
-                 Chunk* chunks, int num_chunks) {
-    if (!queue_.empty()) {
-      cout << "THE QUEUE ISNT EMPTY MAJOR ERROR";
-      return;
-    }
-    TimeValue tmp;
-    int64_t running = 0;
-    points.clear();
-    points.push_back({0, 0});
+// an open dataset. once memory goes over the budget the Datasets that
+// were used the longest ago are evicted, keeping only their files and
+// View, until LoadDataset loads it back from the files and their cache
+// (see cache.h)
+struct OpenDataset {
+  string dir_path;
+  string trace_file;
+  string chunk_file;
+  // held by every call on the dataset and through its loads
+  mutex mu;
+  unique_ptr<Dataset> dataset;  // null until loaded and while evicted
+  Dataset::View view;           // while evicted
+  // set by CloseDataset, stops a load in progress
+  atomic<bool> closed{false};
+  // under datasets_mu
+  uint64_t last_used = 0;
+  size_t bytes = 0;  // while loaded
+};
 
-    int i = 0;
-    while (i < num_chunks) {
-      if (IsTraceFiltered(traces_[chunks[i].stack_index])) {
-        i++;
-        continue;
-      }
-      if (!queue_.empty() && queue_.top().time < chunks[i].timestamp_start) {
-        tmp.time = queue_.top().time;
-        running += queue_.top().value;
-        tmp.value = running;
-        queue_.pop();
-        points.push_back(tmp);
-      } else {
-        running += chunks[i].size;
-        if (running > max_aggregate) max_aggregate = running;
-        tmp.time = chunks[i].timestamp_start;
-        tmp.value = running;
-        points.push_back(tmp);
-        tmp.time = chunks[i].timestamp_end;
-        tmp.value = -chunks[i].size;
-        queue_.push(tmp);
-        i++;
-      }
+// half of the physical memory
+static size_t DefaultMemoryBudget() {
+  long pages = sysconf(_SC_PHYS_PAGES);
+  long page_size = sysconf(_SC_PAGESIZE);
+  if (pages <= 0 || page_size <= 0) return SIZE_MAX;
+  return size_t(pages) * page_size / 2;
+}
+
+// calls can come from the JS thread and from async work on the libuv
+// pool. datasets_mu only guards the map and the LRU state, calls on a
+// dataset are serialized by its own mutex, so a long call or load on one
+// dataset does not hold up the others
+static mutex datasets_mu;
+static unordered_map<DatasetId, shared_ptr<OpenDataset>> datasets;
+static DatasetId next_dataset_id = NO_DATASET + 1;
+static uint64_t use_clock = 0;
+static size_t memory_budget = DefaultMemoryBudget();
+// a setting for every dataset, applied by the calls that use it
+static atomic<size_t> stack_tree_top_k(STACKTREE_TOP_K);
+
+static shared_ptr<OpenDataset> FindDataset(DatasetId id) {
+  lock_guard<mutex> lock(datasets_mu);
+  auto it = datasets.find(id);
+  if (it == datasets.end()) return nullptr;
+  it->second->last_used = ++use_clock;
+  return it->second;
+}
+
+// evict the datasets used the longest ago until the loaded ones fit the
+// budget. keep is never evicted, neither are datasets in use right now
+static void EnforceBudget(DatasetId keep) {
+  vector<pair<shared_ptr<OpenDataset>, unique_lock<mutex>>> evicted;
+  {
+    lock_guard<mutex> lock(datasets_mu);
+    size_t total = 0;
+    vector<pair<uint64_t, DatasetId>> lru;
+    for (auto& d : datasets) {
+      if (d.second->bytes == 0) continue;
+      total += d.second->bytes;
+      if (d.first != keep) lru.push_back({d.second->last_used, d.first});
     }
-    // drain the queue
-    while (!queue_.empty()) {
-      tmp.time = queue_.top().time;
-      running += queue_.top().value;
-      tmp.value = running;
-      queue_.pop();
-      points.push_back(tmp);
+    sort(lru.begin(), lru.end());
+    for (auto& l : lru) {
+      if (total <= memory_budget) break;
+      shared_ptr<OpenDataset>& open = datasets[l.second];
+      unique_lock<mutex> idle(open->mu, try_to_lock);
+      if (!idle.owns_lock()) continue;
+      total -= open->bytes;
+      open->bytes = 0;
+      evicted.emplace_back(open, move(idle));
     }
-    // points.push_back({max_time_,0});
   }
+  // freeing takes a while, only the evicted datasets are locked meanwhile
+  for (auto& e : evicted) {
+    OpenDataset& open = *e.first;
+    open.view = open.dataset->GetView();
+    open.dataset.reset();
+  }
+}
 
-  // TODO deduplicate this code
-  void Aggregate(vector<TimeValue>& points, uint64_t& max_aggregate,
-                 vector<Chunk*>& chunks) {
-    int num_chunks = chunks.size();
-    if (!queue_.empty()) {
-      cout << "THE QUEUE ISNT EMPTY MAJOR ERROR";
-      return;
-    }
-    TimeValue tmp;
-    int64_t running = 0;
-    points.clear();
-    points.push_back({0, 0});
+// load the dataset of open, with its mutex held. a closed dataset stops
+// loading with msg "cancelled". the caller enforces the memory budget
+// once it let go of the mutex, EnforceBudget locks other datasets
+static bool Load(OpenDataset& open, string& msg, const ProgressFn& progress) {
+  unique_ptr<Dataset> dataset(new Dataset());
+  if (!dataset->Open(open.dir_path, open.trace_file, open.chunk_file, msg,
+                     progress, [&open]() { return open.closed.load(); }))
+    return false;
+  dataset->SetView(open.view);
+  open.dataset = move(dataset);
+
+  size_t bytes = open.dataset->Bytes();
+  {
+    lock_guard<mutex> lock(datasets_mu);
+    open.bytes = bytes;
+  }
+  return true;
+}
 
-    int i = 0;
-    while (i < num_chunks) {
-      if (IsTraceFiltered(traces_[chunks[i]->stack_index])) {
-        i++;
-        continue;
-      }
-      if (!queue_.empty() && queue_.top().time < chunks[i]->timestamp_start) {
-        tmp.time = queue_.top().time;
-        running += queue_.top().value;
-        tmp.value = running;
-        queue_.pop();
-        points.push_back(tmp);
-      } else {
-        running += chunks[i]->size;
-        if (running > max_aggregate) max_aggregate = running;
-        tmp.time = chunks[i]->timestamp_start;
-        tmp.value = running;
-        points.push_back(tmp);
-        tmp.time = chunks[i]->timestamp_end;
-        tmp.value = -chunks[i]->size;
-        queue_.push(tmp);
-        i++;
-      }
-    }
-    // drain the queue
-    while (!queue_.empty()) {
-      tmp.time = queue_.top().time;
-      running += queue_.top().value;
-      tmp.value = running;
-      queue_.pop();
-      points.push_back(tmp);
-    }
+// dataset of open, with its mutex held. null if it is closed or evicted,
+// an evicted dataset is only loaded back by LoadDataset, which reports
+// progress and runs off the calling thread. the JS asks DatasetLoaded
+// first, these calls come in redraw loops and fail quietly
+static Dataset* Loaded(OpenDataset& open) {
+  if (open.closed) return nullptr;
+  return open.dataset.get();
+}
+
+// call fn on dataset id with it locked. false if there is no such
+// dataset or it is evicted. if fn can grow the dataset (aggregates,
+// pyramids, stack tree values, ...) it is measured again and the memory
+// budget enforced once it is unlocked
+static bool WithDataset(DatasetId id, const function<void(Dataset&)>& fn,
+                        bool grows = false) {
+  shared_ptr<OpenDataset> open = FindDataset(id);
+  if (!open) return false;
+  {
+    lock_guard<mutex> lock(open->mu);
+    Dataset* dataset = Loaded(*open);
+    if (!dataset) return false;
+    fn(*dataset);
+    if (!grows) return true;
+    size_t bytes = dataset->Bytes();
+    lock_guard<mutex> datasets_lock(datasets_mu);
+    // CloseDataset may have dropped it meanwhile
+    if (open->closed) return true;
+    open->bytes = bytes;
   }
-};
+  EnforceBudget(id);
+  return true;
+}
 
-// its just easier this way ...
-static Dataset theDataset;
+// the same for two datasets at once, both locked without ordering
+// deadlocks. a and b may be the same
+static bool WithDatasets(DatasetId a, DatasetId b,
+                         const function<void(Dataset&, Dataset&)>& fn) {
+  shared_ptr<OpenDataset> open_a = FindDataset(a);
+  shared_ptr<OpenDataset> open_b = FindDataset(b);
+  if (!open_a || !open_b) return false;
+  unique_lock<mutex> lock_a(open_a->mu, defer_lock);
+  unique_lock<mutex> lock_b(open_b->mu, defer_lock);
+  if (open_a == open_b)
+    lock_a.lock();
+  else
+    lock(lock_a, lock_b);
+  Dataset* dataset_a = Loaded(*open_a);
+  Dataset* dataset_b = Loaded(*open_b);
+  if (!dataset_a || !dataset_b) return false;
+  fn(*dataset_a, *dataset_b);
+  return true;
+}
 
-bool SetDataset(const std::string& dir_path, const string& trace_file, const string& chunk_file,
-                string& msg) {
-  return theDataset.Reset(dir_path, trace_file, chunk_file, msg);
+DatasetId SetDataset(const std::string& dir_path, const string& trace_file,
+                     const string& chunk_file) {
+  auto open = make_shared<OpenDataset>();
+  open->dir_path = dir_path;
+  open->trace_file = trace_file;
+  open->chunk_file = chunk_file;
+
+  lock_guard<mutex> lock(datasets_mu);
+  DatasetId id = next_dataset_id++;
+  open->last_used = ++use_clock;
+  datasets[id] = open;
+  return id;
 }
 
-void AggregateAll(std::vector<TimeValue>& values) {
-  theDataset.AggregateAll(values);
+bool LoadDataset(DatasetId id, string& msg, const ProgressFn& progress) {
+  shared_ptr<OpenDataset> open = FindDataset(id);
+  if (!open) {
+    msg = "no dataset " + to_string(id);
+    return false;
+  }
+  bool loaded;
+  {
+    lock_guard<mutex> lock(open->mu);
+    if (open->dataset) return true;
+    loaded = Load(*open, msg, progress);
+  }
+  if (loaded)
+    EnforceBudget(id);
+  else
+    CloseDataset(id);
+  return loaded;
+}
+
+bool DatasetLoaded(DatasetId id) {
+  // not the dataset mutex, a load holds it
+  lock_guard<mutex> lock(datasets_mu);
+  auto it = datasets.find(id);
+  return it != datasets.end() && it->second->bytes > 0;
+}
+
+void CloseDataset(DatasetId id) {
+  shared_ptr<OpenDataset> open;
+  {
+    lock_guard<mutex> lock(datasets_mu);
+    auto it = datasets.find(id);
+    if (it == datasets.end()) return;
+    open = move(it->second);
+    datasets.erase(it);
+  }
+  open->closed = true;
+  // freed here, or by the call or load still holding it
 }
 
-uint64_t MaxAggregate() { return theDataset.MaxAggregate(); }
+void SetMemoryBudget(size_t bytes) {
+  {
+    lock_guard<mutex> lock(datasets_mu);
+    memory_budget = bytes;
+  }
+  EnforceBudget(NO_DATASET);
+}
+
+void AggregateAll(DatasetId id, std::vector<TimeValue>& values,
+                  const CancelFn& cancelled) {
+  WithDataset(id, [&](Dataset& d) { d.AggregateAll(values, cancelled); },
+              true);
+}
+
+uint64_t MaxAggregate(DatasetId id) {
+  uint64_t value = 0;
+  WithDataset(id, [&](Dataset& d) { value = d.MaxAggregate(); });
+  return value;
+}
 
 // TODO maybe these should just default to the filtered numbers?
-uint64_t MaxTime() { return theDataset.MaxTime(); }
+uint64_t MaxTime(DatasetId id) {
+  uint64_t time = 0;
+  WithDataset(id, [&](Dataset& d) { time = d.MaxTime(); });
+  return time;
+}
 
-uint64_t MinTime() { return theDataset.MinTime(); }
+uint64_t MinTime(DatasetId id) {
+  uint64_t time = 0;
+  WithDataset(id, [&](Dataset& d) { time = d.MinTime(); });
+  return time;
+}
 
-uint64_t FilterMaxTime() { return theDataset.FilterMaxTime(); }
+uint64_t FilterMaxTime(DatasetId id) {
+  uint64_t time = 0;
+  WithDataset(id, [&](Dataset& d) { time = d.FilterMaxTime(); });
+  return time;
+}
 
-uint64_t FilterMinTime() { return theDataset.FilterMinTime(); }
+uint64_t FilterMinTime(DatasetId id) {
+  uint64_t time = 0;
+  WithDataset(id, [&](Dataset& d) { time = d.FilterMinTime(); });
+  return time;
+}
 
-void SetTraceKeyword(const std::string& keyword) {
+void SetTraceKeyword(DatasetId id, const std::string& keyword) {
   // will only include traces that contain this keyword
-  theDataset.SetTraceFilter(keyword);
+  WithDataset(id, [&](Dataset& d) { d.SetTraceFilter(keyword); });
 }
 
-void SetTypeKeyword(const std::string& keyword) {
+void SetTypeKeyword(DatasetId id, const std::string& keyword) {
   // will only include traces that contain this keyword
-  theDataset.SetTypeFilter(keyword);
+  WithDataset(id, [&](Dataset& d) { d.SetTypeFilter(keyword); });
+}
+
+void Traces(DatasetId id, std::vector<TraceValue>& traces,
+            const CancelFn& cancelled) {
+  WithDataset(id, [&](Dataset& d) { d.Traces(traces, cancelled); });
+}
+
+std::string TraceText(DatasetId id, int trace_index) {
+  string text;
+  WithDataset(id, [&](Dataset& d) { text = d.TraceText(trace_index); });
+  return text;
+}
+
+std::vector<std::string> TypeNames(DatasetId id) {
+  vector<string> names;
+  WithDataset(id, [&](Dataset& d) { names = d.TypeNames(); });
+  return names;
+}
+
+void AggregateTrace(DatasetId id, std::vector<TimeValue>& values,
+                    int trace_index) {
+  WithDataset(id, [&](Dataset& d) { d.AggregateTrace(values, trace_index); },
+              true);
+}
+
+void TraceChunks(DatasetId id, std::vector<Chunk>& chunks, int trace_index,
+                 int chunk_index, int num_chunks) {
+  WithDataset(id, [&](Dataset& d) {
+    d.TraceChunks(chunks, trace_index, chunk_index, num_chunks);
+  });
 }
 
-void Traces(std::vector<TraceValue>& traces) { theDataset.Traces(traces); }
+void SetFilterMinMax(DatasetId id, uint64_t min, uint64_t max) {
+  WithDataset(id, [&](Dataset& d) { d.SetFilterMinMax(min, max); });
+}
 
-void AggregateTrace(std::vector<TimeValue>& values, int trace_index) {
-  theDataset.AggregateTrace(values, trace_index);
+void TraceFilterReset(DatasetId id) {
+  WithDataset(id, [&](Dataset& d) { d.TraceFilterReset(); });
 }
 
-void TraceChunks(std::vector<Chunk*>& chunks, int trace_index, int chunk_index,
-                 int num_chunks) {
-  theDataset.TraceChunks(chunks, trace_index, chunk_index, num_chunks);
+void TypeFilterReset(DatasetId id) {
+  WithDataset(id, [&](Dataset& d) { d.TypeFilterReset(); });
 }
 
-void SetFilterMinMax(uint64_t min, uint64_t max) {
-  theDataset.SetFilterMinMax(min, max);
+void FilterMinMaxReset(DatasetId id) {
+  WithDataset(id, [&](Dataset& d) { d.FilterMinMaxReset(); });
 }
 
-void TraceFilterReset() { theDataset.TraceFilterReset(); }
+uint64_t Inefficiencies(DatasetId id, int trace_index) {
+  uint64_t i = 0;
+  WithDataset(id, [&](Dataset& d) { i = d.Inefficiences(trace_index); });
+  return i;
+}
 
-void TypeFilterReset() { theDataset.TypeFilterReset(); }
+uint64_t GlobalAllocTime(DatasetId id) {
+  uint64_t time = 0;
+  WithDataset(id, [&](Dataset& d) { time = d.GlobalAllocTime(); });
+  return time;
+}
 
-void FilterMinMaxReset() { theDataset.FilterMinMaxReset(); }
+int64_t LiveBytes(const Trace* t, uint64_t time) {
+  // the first point at or after time, or the one before if it is after
+  auto it = lower_bound(
+      t->aggregate.begin(), t->aggregate.end(), time,
+      [](const TimeValue& a, uint64_t time) { return a.time < time; });
+  if (it == t->aggregate.end()) return 0;
+  if (it != t->aggregate.begin() && it->time > time) it--;
+  return it->value;
+}
 
-uint64_t Inefficiencies(int trace_index) {
-  return theDataset.Inefficiences(trace_index);
+void LiveBytesDelta(DatasetId id, std::vector<TraceDelta>& deltas, uint64_t t1,
+                    uint64_t t2) {
+  WithDataset(id, [&](Dataset& d) { d.LiveBytesDelta(deltas, t1, t2); });
 }
 
-uint64_t GlobalAllocTime() { return theDataset.GlobalAllocTime(); }
+void StackTreeObject(DatasetId id,
+                     const v8::FunctionCallbackInfo<v8::Value>& args,
+                     int first) {
+  WithDataset(id, [&](Dataset& d) {
+    d.SetStackTreeTopK(stack_tree_top_k);
+    d.StackTreeObject(args, first);
+  });
+}
 
-void StackTreeObject(const v8::FunctionCallbackInfo<v8::Value>& args) {
-  theDataset.StackTreeObject(args);
+void StackTreeChildren(DatasetId id,
+                       const v8::FunctionCallbackInfo<v8::Value>& args,
+                       int first) {
+  WithDataset(id, [&](Dataset& d) {
+    d.SetStackTreeTopK(stack_tree_top_k);
+    d.StackTreeChildren(args, first);
+  });
 }
 
-void StackTreeAggregate(std::function<double(const Trace* t)> f) {
-  theDataset.StackTreeAggregate(f);
+void SetStackTreeTopK(size_t k) { stack_tree_top_k = k; }
+
+size_t StackTreeTopK() { return stack_tree_top_k; }
+
+void StackTreeAggregate(DatasetId id, std::function<double(const Trace* t)> f,
+                        const CancelFn& cancelled) {
+  WithDataset(id, [&](Dataset& d) { d.StackTreeAggregate(f, cancelled); },
+              true);
+}
+
+bool ExportFolded(DatasetId id, const std::string& path,
+                  std::function<uint64_t(const Trace* t)> f, std::string& msg) {
+  bool ok = false;
+  if (!WithDataset(id, [&](Dataset& d) { ok = d.ExportFolded(path, f, msg); }))
+    msg = "no dataset " + to_string(id);
+  return ok;
+}
+
+bool DiffDatasets(DatasetId a, DatasetId b,
+                  std::function<double(const Trace* t)> f, DatasetDiff& diff,
+                  std::string& msg) {
+  if (!WithDatasets(a, b, [&](Dataset& before, Dataset& after) {
+        before.DiffWith(after, f, diff);
+      })) {
+    msg = "dataset " + to_string(a) + " or " + to_string(b) +
+          " is not loaded";
+    return false;
+  }
+  return true;
 }
 
 }  // namespace memoro
@@ -27,12 +27,15 @@
 
 namespace memoro {
 
+struct DatasetDiff;
+
 enum LoadingState : uint32_t {
   LoadData = 0,
   Parsing,
   Sorting,
   Building,
   Aggregating,
+  Scoring,
   Done
 };
 
@@ -52,33 +55,67 @@ struct __attribute__((packed)) Chunk {
   uint32_t access_interval_high = 0;
 };
 
+// version of the trace and chunk files read
+#define VERSION_MAJOR 0
+#define VERSION_MINOR 1
+
+// at the start of the trace and chunk files, followed by an index of
+// index_size uint16_t and then the traces or chunks
+struct __attribute__((packed)) Header {
+  uint8_t version_major = VERSION_MAJOR;
+  uint8_t version_minor = VERSION_MINOR;
+  uint8_t compression_type = 0;
+  uint16_t segment_start = 0;
+  uint32_t index_size = 0;
+};
+
 struct TimeValue {
   uint64_t time;
   int64_t value;
 };
 
+// positions [begin, end) in the ChunkStore
+struct ChunkRange {
+  uint32_t begin = 0;
+  uint32_t end = 0;
+
+  uint32_t size() const { return end - begin; }
+  bool empty() const { return begin == end; }
+};
+
 struct Trace {
   std::string trace;
+  // the frames of trace as ids into the dataset FrameTable, outermost first
+  std::vector<uint32_t> frames;
   std::string type;
+  uint32_t type_id = 0;  // index of type in TypeNames()
   bool filtered = false;
   bool type_filtered = false;
+  // part of the current global aggregate
+  bool in_aggregate = false;
   uint64_t max_aggregate = 0;
-  std::vector<Chunk*> chunks;
+  ChunkRange chunks;
   std::vector<TimeValue> aggregate;
   uint64_t inefficiencies = 0;
   uint64_t alloc_time_total = 0;
+  uint64_t bytes_total = 0;
 
   float usage_score;
   float lifetime_score;
   float useful_lifetime_score;
 };
 
+// heap memory held by the elements of a vector, for the memory budget
+template <typename V>
+size_t VectorBytes(const V& v) {
+  return v.capacity() * sizeof(typename V::value_type);
+}
+
 // API will return a list of these to Node layer
 // changing filters will invalidate the indices
 struct TraceValue {
-  std::string* trace;
-  std::string* type;
   int trace_index;
+  uint32_t type_id;
   int chunk_index;
   int num_chunks;
   uint64_t alloc_time_total;
@@ -89,10 +126,59 @@ struct TraceValue {
   float useful_lifetime_score;
 };
 
-// set the current dataset file, returns dataset stats (num traces, min/max
-// times)
-bool SetDataset(const std::string& file_path, const std::string& trace_file,
-                const std::string& chunk_file, std::string& msg);
+// change of the live bytes of a trace between two times
+struct TraceDelta {
+  int trace_index;
+  int64_t delta;
+};
+
+// where a dataset load is at, reported from the loading thread and the
+// worker pool while it runs
+struct LoadProgress {
+  LoadingState state;
+  uint64_t items;       // done in this state
+  uint64_t total;       // to do in this state
+  uint64_t bytes_read;  // of the trace and chunk files, so far
+  // set once, at the end of Aggregating: the global timeline sampled over
+  // the whole dataset. the scores are not computed yet at that point
+  const std::vector<TimeValue>* timeline;
+};
+
+// called from any thread, must be thread safe
+using ProgressFn = std::function<void(const LoadProgress& progress)>;
+// polled by long calls, once it returns true they stop early. also
+// called from any thread
+using CancelFn = std::function<bool()>;
+
+// datasets are known by the id SetDataset gives them, which all calls on
+// a dataset take. ids are not reused, calls with an unknown or closed id
+// do nothing and return empty results
+using DatasetId = uint32_t;
+#define NO_DATASET 0
+
+// a new dataset for the files, loaded by LoadDataset. other datasets stay
+// open and usable while it loads
+DatasetId SetDataset(const std::string& file_path,
+                     const std::string& trace_file,
+                     const std::string& chunk_file);
+// load the files of dataset id, reporting progress, or load an evicted
+// dataset back with its filters. if it fails the dataset is closed.
+// closing the dataset cancels the load, which then returns false with msg
+// "cancelled"
+bool LoadDataset(DatasetId id, std::string& msg,
+                 const ProgressFn& progress = nullptr);
+// whether dataset id is in memory, does not wait for a load in progress
+bool DatasetLoaded(DatasetId id);
+void CloseDataset(DatasetId id);
+
+// memory the loaded datasets may take, half the physical memory by
+// default. past it the datasets used the longest ago are evicted, down to
+// their file paths and filters. calls on an evicted dataset do nothing
+// until LoadDataset loads it back
+void SetMemoryBudget(size_t bytes);
+
+// all of these can be called from any thread, calls on a dataset are
+// serialized
 
 // add a timestamp interval filter
 void SetMinMaxTime(uint64_t max, uint64_t min);
@@ -100,42 +186,94 @@ void RemoveMinMaxTime();
 
 // add a trace keyword filter, filtering traces not containing the keyword
 // returns new number of active traces
-void SetTraceKeyword(const std::string& keyword);
-void RemoveTraceKeyword(const std::string& keyword);
-void TraceFilterReset();
+void SetTraceKeyword(DatasetId id, const std::string& keyword);
+void RemoveTraceKeyword(DatasetId id, const std::string& keyword);
+void TraceFilterReset(DatasetId id);
 
-void SetTypeKeyword(const std::string& keyword);
-void TypeFilterReset();
+void SetTypeKeyword(DatasetId id, const std::string& keyword);
+void TypeFilterReset(DatasetId id);
 
 // fill times and values with 1000 aggregate data points from whole dataset
-// respects filters
-void AggregateAll(std::vector<TimeValue>& values);
+// respects filters. leaves values empty if cancelled
+void AggregateAll(DatasetId id, std::vector<TimeValue>& values,
+                  const CancelFn& cancelled = nullptr);
 
 // aggregate chunks of a single stacktrace
-void AggregateTrace(std::vector<TimeValue>& values, int trace_index);
+void AggregateTrace(DatasetId id, std::vector<TimeValue>& values,
+                    int trace_index);
 
 // get the specified number of chunks starting at the specified indexes
-// respects filters, returns empty if all filtered
-void TraceChunks(std::vector<Chunk*>& chunks, int trace_index, int chunk_index,
-                 int num_chunks);
+// respects filters, returns empty if all filtered. chunk indexes count the
+// chunks of the trace live in the time window, in start order. the chunks
+// are copies, the dataset may be evicted once the call returns
+void TraceChunks(DatasetId id, std::vector<Chunk>& chunks, int trace_index,
+                 int chunk_index, int num_chunks);
+
+// build list of traces. the list is cut short if cancelled
+void Traces(DatasetId id, std::vector<TraceValue>& traces,
+            const CancelFn& cancelled = nullptr);
+
+// the text of a trace, and every distinct trace type by type_id (0 is no
+// type). lists of traces only carry the ids, so the strings can be fetched
+// once and cached
+std::string TraceText(DatasetId id, int trace_index);
+std::vector<std::string> TypeNames(DatasetId id);
+
+void SetFilterMinMax(DatasetId id, uint64_t min, uint64_t max);
+void FilterMinMaxReset(DatasetId id);
+
+uint64_t MaxTime(DatasetId id);
+uint64_t MinTime(DatasetId id);
+uint64_t FilterMaxTime(DatasetId id);
+uint64_t FilterMinTime(DatasetId id);
+uint64_t GlobalAllocTime(DatasetId id);
+
+// number of threads used to load and process datasets,
+// 0 selects the number of hardware threads
+void SetNumWorkers(unsigned num_workers);
+
+uint64_t Inefficiencies(DatasetId id, int trace_index);
 
-// build list of traces
-void Traces(std::vector<TraceValue>& traces);
+uint64_t MaxAggregate(DatasetId id);
 
-void SetFilterMinMax(uint64_t min, uint64_t max);
-void FilterMinMaxReset();
+// live bytes of a trace at time, a binary search over its aggregate
+int64_t LiveBytes(const Trace* t, uint64_t time);
 
-uint64_t MaxTime();
-uint64_t MinTime();
-uint64_t FilterMaxTime();
-uint64_t FilterMinTime();
-uint64_t GlobalAllocTime();
+// the traces whose live bytes differ between times t1 and t2, with
+// LiveBytes(t2) - LiveBytes(t1). only traces with chunks allocated or
+// freed in between are looked at, so nearby times are cheap
+void LiveBytesDelta(DatasetId id, std::vector<TraceDelta>& deltas, uint64_t t1,
+                    uint64_t t2);
 
-uint64_t Inefficiencies(int trace_index);
+// the stack tree as JS objects, args (count, depth) from args[first] on
+// optionally limit it to the largest count children per node and depth
+// levels
+void StackTreeObject(DatasetId id,
+                     const v8::FunctionCallbackInfo<v8::Value>& args,
+                     int first);
+// args (node id, offset, count) from args[first] on, a page of the
+// children of a node
+void StackTreeChildren(DatasetId id,
+                       const v8::FunctionCallbackInfo<v8::Value>& args,
+                       int first);
+// children shown per stack tree node, the rest are rolled up into "other".
+// for all datasets and the diff tree
+void SetStackTreeTopK(size_t k);
+size_t StackTreeTopK();
+// if cancelled the tree keeps the values it had
+void StackTreeAggregate(DatasetId id, std::function<double(const Trace* t)> f,
+                        const CancelFn& cancelled = nullptr);
 
-uint64_t MaxAggregate();
+// write every trace with its value f(trace) to path in the collapsed stack
+// format of flame graph tools, see folded.h
+bool ExportFolded(DatasetId id, const std::string& path,
+                  std::function<uint64_t(const Trace* t)> f, std::string& msg);
 
-void StackTreeObject(const v8::FunctionCallbackInfo<v8::Value>& args);
-void StackTreeAggregate(std::function<double(const Trace* t)> f);
+// compare dataset a, before a change, with dataset b, after it: their
+// traces aligned by call path, with the change of each, and a tree of both
+// weighted by f. see diff.h
+bool DiffDatasets(DatasetId a, DatasetId b,
+                  std::function<double(const Trace* t)> f, DatasetDiff& diff,
+                  std::string& msg);
 
 }  // namespace memoro
@@ -17,10 +17,17 @@
 #include <uv.h>
 #include <v8.h>
 #include <algorithm>
-#include <numeric>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "diff.h"
 #include "memoro.h"
 #include "pattern.h"
+#include "stacktree.h"
 
 using namespace v8;
 using namespace memoro;
@@ -30,22 +37,126 @@ using namespace memoro;
 // more or less the interface just converts to/from in memory data structures
 // (memoro.h/cc) to V8 JS objects that are passed back to the JS gui layer
 
+// a series as {ts, value}, two Float64Arrays over one ArrayBuffer, so
+// the graphs can draw it without a JS object per point
+static Local<Object> SeriesObject(Isolate* isolate,
+                                  const std::vector<TimeValue>& values) {
+  size_t n = values.size();
+  Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, 2 * n * sizeof(double));
+  double* data = static_cast<double*>(buffer->GetContents().Data());
+  for (size_t i = 0; i < n; i++) {
+    data[i] = values[i].time;
+    data[n + i] = values[i].value;
+  }
+
+  Local<Object> result = Object::New(isolate);
+  result->Set(String::NewFromUtf8(isolate, "ts"),
+              Float64Array::New(buffer, 0, n));
+  result->Set(String::NewFromUtf8(isolate, "value"),
+              Float64Array::New(buffer, n * sizeof(double), n));
+  return result;
+}
+
+// at most one load progress event per this many ms, plus one per state
+#define PROGRESS_INTERVAL_MS 100
+
 struct LoadDatasetWork {
   uv_work_t request;
+  uv_async_t progress_async;
   Persistent<Function> callback;
+  Persistent<Function> progress_callback;  // may be empty
 
-  std::string dir_path;
-  std::string trace_path;
-  std::string chunk_path;
+  DatasetId id;
   std::string msg;
   bool result;
+
+  // the latest progress, set from the loading threads and sent to JS on
+  // the loop thread
+  std::mutex progress_mu;
+  LoadProgress progress;
+  std::vector<TimeValue> timeline;
+  bool timeline_pending = false;
+  bool progress_pending = false;
+  std::chrono::steady_clock::time_point last_sent;
 };
 
+static const char* const kLoadingStates[] = {
+    "load_data", "parsing", "sorting", "building",
+    "aggregating", "scoring", "done"};
+
+static void QueueProgress(LoadDatasetWork* work, const LoadProgress& p) {
+  auto now = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<std::mutex> lock(work->progress_mu);
+    bool changed = p.state != work->progress.state;
+    work->progress = p;
+    work->progress.timeline = nullptr;
+    if (p.timeline) {
+      work->timeline = *p.timeline;
+      work->timeline_pending = true;
+    }
+    if (!changed && !p.timeline &&
+        now - work->last_sent <
+            std::chrono::milliseconds(PROGRESS_INTERVAL_MS))
+      return;
+    work->last_sent = now;
+    work->progress_pending = true;
+  }
+  uv_async_send(&work->progress_async);
+}
+
+static void SendProgress(uv_async_t* handle) {
+  Isolate* isolate = Isolate::GetCurrent();
+  v8::HandleScope handleScope(isolate);
+
+  LoadDatasetWork* work = static_cast<LoadDatasetWork*>(handle->data);
+  LoadProgress p;
+  std::vector<TimeValue> timeline;
+  bool has_timeline;
+  {
+    std::lock_guard<std::mutex> lock(work->progress_mu);
+    if (!work->progress_pending) return;
+    work->progress_pending = false;
+    p = work->progress;
+    has_timeline = work->timeline_pending;
+    work->timeline_pending = false;
+    timeline.swap(work->timeline);
+  }
+  if (work->progress_callback.IsEmpty()) return;
+
+  Local<Object> result = Object::New(isolate);
+  result->Set(String::NewFromUtf8(isolate, "state"),
+              Number::New(isolate, p.state));
+  result->Set(String::NewFromUtf8(isolate, "state_name"),
+              String::NewFromUtf8(isolate, kLoadingStates[p.state]));
+  result->Set(String::NewFromUtf8(isolate, "items"),
+              Number::New(isolate, p.items));
+  result->Set(String::NewFromUtf8(isolate, "total"),
+              Number::New(isolate, p.total));
+  result->Set(String::NewFromUtf8(isolate, "bytes_read"),
+              Number::New(isolate, p.bytes_read));
+  if (has_timeline)
+    result->Set(String::NewFromUtf8(isolate, "timeline"),
+                SeriesObject(isolate, timeline));
+
+  Local<Value> argv[1] = {result};
+  Local<Function>::New(isolate, work->progress_callback)
+      ->Call(isolate->GetCurrentContext()->Global(), 1, argv);
+}
+
 static void LoadDatasetAsync(uv_work_t* req) {
   LoadDatasetWork* work = static_cast<LoadDatasetWork*>(req->data);
 
   work->result =
-      SetDataset(work->dir_path, work->trace_path, work->chunk_path, work->msg);
+      LoadDataset(work->id, work->msg,
+                  [work](const LoadProgress& p) { QueueProgress(work, p); });
+}
+
+static void LoadDatasetClosed(uv_handle_t* handle) {
+  LoadDatasetWork* work = static_cast<LoadDatasetWork*>(handle->data);
+  work->callback.Reset();
+  work->progress_callback.Reset();
+  delete work;
 }
 
 static void LoadDatasetAsyncComplete(uv_work_t* req, int status) {
@@ -56,12 +167,18 @@ static void LoadDatasetAsyncComplete(uv_work_t* req, int status) {
   v8::HandleScope handleScope(isolate);
 
   LoadDatasetWork* work = static_cast<LoadDatasetWork*>(req->data);
+  // the last progress may not have been sent yet, it goes first
+  SendProgress(&work->progress_async);
 
   Local<Object> result = Object::New(isolate);
   result->Set(String::NewFromUtf8(isolate, "message"),
               String::NewFromUtf8(isolate, work->msg.c_str()));
   result->Set(String::NewFromUtf8(isolate, "result"),
               Boolean::New(isolate, work->result));
+  result->Set(String::NewFromUtf8(isolate, "cancelled"),
+              Boolean::New(isolate, !work->result && work->msg == "cancelled"));
+  result->Set(String::NewFromUtf8(isolate, "id"),
+              Number::New(isolate, work->id));
 
   // set up return arguments
   Local<Value> argv[1] = {result};
@@ -70,11 +187,181 @@ static void LoadDatasetAsyncComplete(uv_work_t* req, int status) {
   Local<Function>::New(isolate, work->callback)
       ->Call(isolate->GetCurrentContext()->Global(), 1, argv);
 
-  // Free up the persistent function callback
+  // the work is freed once the progress handle is closed
+  uv_close(reinterpret_cast<uv_handle_t*>(&work->progress_async),
+           LoadDatasetClosed);
+}
+
+// the heavy calls also have an async variant, run on the libuv pool and
+// reporting to a callback with {result, cancelled, message}. async work on
+// a dataset runs one at a time in the order it was queued, so work queued
+// after a filter change sees the filter, while the queues of different
+// datasets run side by side. a call of a kind with a generation
+// supersedes the earlier calls of its kind on the same dataset: those not
+// started yet are skipped, a running one stops early where its loops poll
+// for it (aggregates, stack tree sums, trace lists) and its results are
+// dropped, and both report cancelled. synchronous calls of a kind
+// supersede queued work as well. keyword filters add up, so they join
+// their kind without superseding each other, and a reset of the filter
+// supersedes them
+enum AsyncKind : uint32_t {
+  AsyncSort = 0,
+  AsyncAggregate,
+  AsyncStackTree,
+  AsyncDiff,
+  AsyncTimeFilter,
+  AsyncTraceFilter,
+  AsyncTypeFilter,
+  NumAsyncKinds,
+  AsyncOrdered = NumAsyncKinds  // never superseded
+};
+
+// by dataset and kind, so work on one dataset does not supersede work on
+// another. diffs span two datasets and are kept under NO_DATASET
+static std::mutex generations_mu;
+static std::unordered_map<uint64_t, uint64_t> async_generations;
+
+static uint64_t GenerationKey(DatasetId id, AsyncKind kind) {
+  return (uint64_t(id) << 32) | kind;
+}
+
+struct AsyncWork {
+  uv_work_t request;
+  Persistent<Function> callback;
+
+  DatasetId id;
+  AsyncKind kind;
+  uint64_t generation = 0;
+  bool cancelled = false;
+  // on the pool, cancelled turns true once the work is superseded
+  std::function<void(const CancelFn& cancelled)> run;
+  // back on the JS thread, adds results to the callback argument
+  std::function<void(Isolate*, Local<Object>)> done;
+};
+
+// the work of a dataset, diffs are queued under NO_DATASET
+struct AsyncQueue {
+  std::deque<AsyncWork*> work;
+  bool running = false;
+};
+
+// JS thread only
+static std::unordered_map<DatasetId, AsyncQueue> async_queues;
+
+static uint64_t Supersede(DatasetId id, AsyncKind kind) {
+  std::lock_guard<std::mutex> lock(generations_mu);
+  return ++async_generations[GenerationKey(id, kind)];
+}
+
+static uint64_t Generation(DatasetId id, AsyncKind kind) {
+  std::lock_guard<std::mutex> lock(generations_mu);
+  auto it = async_generations.find(GenerationKey(id, kind));
+  return it == async_generations.end() ? 0 : it->second;
+}
+
+static bool Superseded(const AsyncWork* work) {
+  return work->kind != AsyncOrdered &&
+         Generation(work->id, work->kind) != work->generation;
+}
+
+static void RunAsync(uv_work_t* req) {
+  AsyncWork* work = static_cast<AsyncWork*>(req->data);
+  if (Superseded(work)) {
+    work->cancelled = true;
+    return;
+  }
+  work->run([work]() { return Superseded(work); });
+}
+
+static void StartNextAsync(DatasetId id);
+
+static void RunAsyncComplete(uv_work_t* req, int status) {
+  Isolate* isolate = Isolate::GetCurrent();
+  v8::HandleScope handleScope(isolate);
+
+  AsyncWork* work = static_cast<AsyncWork*>(req->data);
+  async_queues[work->id].running = false;
+  StartNextAsync(work->id);
+
+  if (Superseded(work)) work->cancelled = true;
+  Local<Object> result = Object::New(isolate);
+  result->Set(String::NewFromUtf8(isolate, "message"),
+              String::NewFromUtf8(isolate, work->cancelled ? "cancelled" : ""));
+  result->Set(String::NewFromUtf8(isolate, "result"),
+              Boolean::New(isolate, !work->cancelled));
+  result->Set(String::NewFromUtf8(isolate, "cancelled"),
+              Boolean::New(isolate, work->cancelled));
+  if (!work->cancelled && work->done) work->done(isolate, result);
+
+  Local<Value> argv[1] = {result};
+  Local<Function>::New(isolate, work->callback)
+      ->Call(isolate->GetCurrentContext()->Global(), 1, argv);
+
   work->callback.Reset();
   delete work;
 }
 
+static void StartNextAsync(DatasetId id) {
+  auto it = async_queues.find(id);
+  if (it == async_queues.end() || it->second.running) return;
+  AsyncQueue& queue = it->second;
+  if (queue.work.empty()) {
+    async_queues.erase(it);
+    return;
+  }
+  AsyncWork* work = queue.work.front();
+  queue.work.pop_front();
+  queue.running = true;
+  uv_queue_work(uv_default_loop(), &work->request, RunAsync, RunAsyncComplete);
+}
+
+// queue run on dataset id, with the callback in args[callback_arg].
+// without supersede it joins the current generation of its kind
+static void QueueAsync(
+    const v8::FunctionCallbackInfo<v8::Value>& args, int callback_arg,
+    DatasetId id, AsyncKind kind,
+    std::function<void(const CancelFn& cancelled)> run,
+    std::function<void(Isolate*, Local<Object>)> done = nullptr,
+    bool supersede = true) {
+  Isolate* isolate = args.GetIsolate();
+  AsyncWork* work = new AsyncWork();
+  work->request.data = work;
+  work->id = id;
+  work->kind = kind;
+  if (kind != AsyncOrdered)
+    work->generation = supersede ? Supersede(id, kind) : Generation(id, kind);
+  work->run = std::move(run);
+  work->done = std::move(done);
+  work->callback.Reset(isolate, Local<Function>::Cast(args[callback_arg]));
+
+  async_queues[id].work.push_back(work);
+  StartNextAsync(id);
+  args.GetReturnValue().Set(Undefined(isolate));
+}
+
+// run LoadDataset on the libuv pool for dataset id, with the callback in
+// args[callback_arg] and the optional progress callback after it
+static void QueueLoad(const v8::FunctionCallbackInfo<v8::Value>& args,
+                      DatasetId id, int callback_arg) {
+  Isolate* isolate = args.GetIsolate();
+  LoadDatasetWork* work = new LoadDatasetWork();
+  work->request.data = work;
+  work->id = id;
+
+  Local<Function> callback = Local<Function>::Cast(args[callback_arg]);
+  work->callback.Reset(isolate, callback);
+  // optional, called with {state, state_name, items, total, bytes_read}
+  // as the load goes and once with the timeline when it is ready
+  if (args[callback_arg + 1]->IsFunction())
+    work->progress_callback.Reset(
+        isolate, Local<Function>::Cast(args[callback_arg + 1]));
+  work->progress_async.data = work;
+  uv_async_init(uv_default_loop(), &work->progress_async, SendProgress);
+
+  uv_queue_work(uv_default_loop(), &work->request, LoadDatasetAsync,
+                LoadDatasetAsyncComplete);
+}
+
 void Memoro_SetDataset(const v8::FunctionCallbackInfo<v8::Value>& args) {
   Isolate* isolate = args.GetIsolate();
 
@@ -88,39 +375,75 @@ void Memoro_SetDataset(const v8::FunctionCallbackInfo<v8::Value>& args) {
   std::string chunk_path(*chunk_file);
 
   // launch in a separate thread with callback to keep the gui responsive
-  // since this can take some time
-  LoadDatasetWork* work = new LoadDatasetWork();
-  work->request.data = work;
-  work->dir_path = dir_path;
-  work->trace_path = trace_path;
-  work->chunk_path = chunk_path;
+  // since this can take some time. the id is returned right away, the
+  // dataset can be used once the callback got {result, cancelled, message,
+  // id}. other datasets stay usable meanwhile
+  DatasetId id = SetDataset(dir_path, trace_path, chunk_path);
+  QueueLoad(args, id, 3);
 
-  Local<Function> callback = Local<Function>::Cast(args[3]);
-  work->callback.Reset(isolate, callback);
+  args.GetReturnValue().Set(Number::New(isolate, id));
+}
 
-  uv_queue_work(uv_default_loop(), &work->request, LoadDatasetAsync,
-                LoadDatasetAsyncComplete);
+// the dataset id of a call, always its first argument
+static DatasetId IdArg(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  return args[0]->Uint32Value();
+}
 
-  args.GetReturnValue().Set(Undefined(isolate));
+// args (id, callback, progress callback) like set_dataset: load an
+// evicted dataset back, calls on it do nothing until then. calls back
+// right away if it is loaded. a failed load closes the dataset
+void Memoro_LoadDataset(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  QueueLoad(args, IdArg(args), 1);
 }
 
-void Memoro_AggregateAll(const v8::FunctionCallbackInfo<v8::Value>& args) {
+// args (id), whether the dataset is in memory, see load_dataset
+void Memoro_DatasetLoaded(const v8::FunctionCallbackInfo<v8::Value>& args) {
   Isolate* isolate = args.GetIsolate();
-  std::vector<TimeValue> values;
-  AggregateAll(values);
+  args.GetReturnValue().Set(Boolean::New(isolate, DatasetLoaded(IdArg(args))));
+}
 
-  auto kTs = String::NewFromUtf8(isolate, "ts");
-  auto kValue = String::NewFromUtf8(isolate, "value");
+// per dataset, the traces as last sorted by sort_traces. JS thread only
+static std::unordered_map<DatasetId, std::vector<TraceValue>> sorted_traces;
+
+// args (id). a load still going calls back cancelled
+void Memoro_CloseDataset(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  DatasetId id = IdArg(args);
+  // work still queued on it is cancelled, a sort would only put its
+  // traces back
+  for (uint32_t kind = 0; kind < NumAsyncKinds; kind++)
+    Supersede(id, AsyncKind(kind));
+  sorted_traces.erase(id);
+  CloseDataset(id);
+}
 
-  Local<Array> result_list = Array::New(isolate);
-  for (unsigned int i = 0; i < values.size(); i++) {
-    Local<Object> result = Object::New(isolate);
-    result->Set(kTs, Number::New(isolate, values[i].time));
-    result->Set(kValue, Number::New(isolate, values[i].value));
-    result_list->Set(i, result);
-  }
+// args (bytes), see SetMemoryBudget
+void Memoro_SetMemoryBudget(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  double bytes = args[0]->NumberValue();
+  SetMemoryBudget(bytes > 0 ? size_t(bytes) : 0);
+}
 
-  args.GetReturnValue().Set(result_list);
+void Memoro_AggregateAll(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  static std::vector<TimeValue> values;
+  values.clear();
+  Supersede(IdArg(args), AsyncAggregate);
+  AggregateAll(IdArg(args), values);
+
+  args.GetReturnValue().Set(SeriesObject(isolate, values));
+}
+
+// args (id, callback), the series is the callback argument's "series"
+void Memoro_AggregateAllAsync(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  DatasetId id = IdArg(args);
+  auto values = std::make_shared<std::vector<TimeValue>>();
+  QueueAsync(args, 1, id, AsyncAggregate,
+             [id, values](const CancelFn& cancelled) {
+               AggregateAll(id, *values, cancelled);
+             },
+             [values](Isolate* isolate, Local<Object> result) {
+               result->Set(String::NewFromUtf8(isolate, "series"),
+                           SeriesObject(isolate, *values));
+             });
 }
 
 void Memoro_AggregateTrace(const v8::FunctionCallbackInfo<v8::Value>& args) {
@@ -128,74 +451,96 @@ void Memoro_AggregateTrace(const v8::FunctionCallbackInfo<v8::Value>& args) {
   static std::vector<TimeValue> values;
   values.clear();
 
-  int trace_index = args[0]->NumberValue();
+  int trace_index = args[1]->NumberValue();
 
-  AggregateTrace(values, trace_index);
+  AggregateTrace(IdArg(args), values, trace_index);
 
-  auto kTs = String::NewFromUtf8(isolate, "ts");
-  auto kValue = String::NewFromUtf8(isolate, "value");
+  args.GetReturnValue().Set(SeriesObject(isolate, values));
+}
 
-  Local<Array> result_list = Array::New(isolate);
-  for (unsigned int i = 0; i < values.size(); i++) {
-    Local<Object> result = Object::New(isolate);
-    result->Set(kTs, Number::New(isolate, values[i].time));
-    result->Set(kValue, Number::New(isolate, values[i].value));
-    result_list->Set(i, result);
+// columnar results: every field is a typed array over one shared
+// ArrayBuffer, so a page of rows costs a few allocations instead of a JS
+// object per row. columns are added widest type first to keep them aligned
+class Columns {
+ public:
+  Columns(Isolate* isolate, size_t rows, size_t row_size)
+      : isolate_(isolate), rows_(rows), result_(Object::New(isolate)) {
+    buffer_ = ArrayBuffer::New(isolate, rows * row_size);
+    data_ = static_cast<char*>(buffer_->GetContents().Data());
+    result_->Set(String::NewFromUtf8(isolate, "length"),
+                 Number::New(isolate, rows));
   }
 
-  args.GetReturnValue().Set(result_list);
-}
+  template <typename T, typename ArrayType>
+  T* Add(const char* name) {
+    T* column = reinterpret_cast<T*>(data_ + offset_);
+    result_->Set(String::NewFromUtf8(isolate_, name),
+                 ArrayType::New(buffer_, offset_, rows_));
+    offset_ += rows_ * sizeof(T);
+    return column;
+  }
+
+  Local<Object> Result() const { return result_; }
+
+ private:
+  Isolate* isolate_;
+  size_t rows_;
+  Local<Object> result_;
+  Local<ArrayBuffer> buffer_;
+  char* data_;
+  size_t offset_ = 0;
+};
 
 void Memoro_TraceChunks(const v8::FunctionCallbackInfo<v8::Value>& args) {
   Isolate* isolate = args.GetIsolate();
-  static std::vector<Chunk*> chunks;
+  static std::vector<Chunk> chunks;
   chunks.clear();
 
-  int trace_index = args[0]->NumberValue();
-  int chunk_index = args[1]->NumberValue();
-  int num_chunks = args[2]->NumberValue();
-
-  TraceChunks(chunks, trace_index, chunk_index, num_chunks);
-
-  auto kNumReads      = String::NewFromUtf8(isolate, "num_reads");
-  auto kNumWrites     = String::NewFromUtf8(isolate, "num_writes");
-  auto kSize          = String::NewFromUtf8(isolate, "size");
-  auto kTsStart       = String::NewFromUtf8(isolate, "ts_start");
-  auto kTsEnd         = String::NewFromUtf8(isolate, "ts_end");
-  auto kTsFirst       = String::NewFromUtf8(isolate, "ts_first");
-  auto kTsLast        = String::NewFromUtf8(isolate, "ts_last");
-  auto kAllocCallTime = String::NewFromUtf8(isolate, "alloc_call_time");
-  auto kMultiThread   = String::NewFromUtf8(isolate, "multiThread");
-  auto kAccessLow     = String::NewFromUtf8(isolate, "access_interval_low");
-  auto kAccessHigh    = String::NewFromUtf8(isolate, "access_interval_high");
-
-  Local<Array> result_list = Array::New(isolate);
-  for (unsigned int i = 0; i < chunks.size(); i++) {
-    Local<Object> result = Object::New(isolate);
-    result->Set(kNumReads, Number::New(isolate, chunks[i]->num_reads));
-    result->Set(kNumWrites, Number::New(isolate, chunks[i]->num_writes));
-    result->Set(kSize, Number::New(isolate, chunks[i]->size));
-    result->Set(kTsStart, Number::New(isolate, chunks[i]->timestamp_start));
-    result->Set(kTsEnd, Number::New(isolate, chunks[i]->timestamp_end));
-    result->Set(kTsFirst, Number::New(isolate, chunks[i]->timestamp_first_access));
-    result->Set(kTsLast, Number::New(isolate, chunks[i]->timestamp_last_access));
-    result->Set(kAllocCallTime, Number::New(isolate, chunks[i]->alloc_call_time));
-    result->Set(kMultiThread, Boolean::New(isolate, chunks[i]->multi_thread));
-    result->Set(kAccessLow, Number::New(isolate, chunks[i]->access_interval_low));
-    result->Set(kAccessHigh, Number::New(isolate, chunks[i]->access_interval_high));
-    result_list->Set(i, result);
+  int trace_index = args[1]->NumberValue();
+  int chunk_index = args[2]->NumberValue();
+  int num_chunks = args[3]->NumberValue();
+
+  TraceChunks(IdArg(args), chunks, trace_index, chunk_index, num_chunks);
+
+  size_t n = chunks.size();
+  Columns columns(isolate, n, 6 * sizeof(double) + 2 * sizeof(uint32_t) + 3);
+  double* size = columns.Add<double, Float64Array>("size");
+  double* ts_start = columns.Add<double, Float64Array>("ts_start");
+  double* ts_end = columns.Add<double, Float64Array>("ts_end");
+  double* ts_first = columns.Add<double, Float64Array>("ts_first");
+  double* ts_last = columns.Add<double, Float64Array>("ts_last");
+  double* alloc_call_time = columns.Add<double, Float64Array>("alloc_call_time");
+  uint32_t* access_low =
+      columns.Add<uint32_t, Uint32Array>("access_interval_low");
+  uint32_t* access_high =
+      columns.Add<uint32_t, Uint32Array>("access_interval_high");
+  uint8_t* num_reads = columns.Add<uint8_t, Uint8Array>("num_reads");
+  uint8_t* num_writes = columns.Add<uint8_t, Uint8Array>("num_writes");
+  uint8_t* multi_thread = columns.Add<uint8_t, Uint8Array>("multi_thread");
+
+  for (size_t i = 0; i < n; i++) {
+    const Chunk& c = chunks[i];
+    size[i] = c.size;
+    ts_start[i] = c.timestamp_start;
+    ts_end[i] = c.timestamp_end;
+    ts_first[i] = c.timestamp_first_access;
+    ts_last[i] = c.timestamp_last_access;
+    alloc_call_time[i] = c.alloc_call_time;
+    access_low[i] = c.access_interval_low;
+    access_high[i] = c.access_interval_high;
+    num_reads[i] = c.num_reads;
+    num_writes[i] = c.num_writes;
+    multi_thread[i] = c.multi_thread;
   }
 
-  args.GetReturnValue().Set(result_list);
+  args.GetReturnValue().Set(columns.Result());
 }
 
-static std::vector<TraceValue> traces;  // just reuse this
-void Memoro_SortTraces(const v8::FunctionCallbackInfo<v8::Value>& args) {
-  traces.clear();
-  Traces(traces);
-
-  v8::String::Utf8Value sortByV8(args[0]);
-  std::string sortBy(*sortByV8, sortByV8.length());
+static void SortTraceValues(DatasetId id, std::vector<TraceValue>& traces,
+                            const std::string& sortBy,
+                            const CancelFn& cancelled = nullptr) {
+  Traces(id, traces, cancelled);
+  if (cancelled && cancelled()) return;
 
   if (sortBy == "bytes") {
     sort(traces.begin(), traces.end(), [](const TraceValue& a, const TraceValue&b) {
@@ -215,49 +560,96 @@ void Memoro_SortTraces(const v8::FunctionCallbackInfo<v8::Value>& args) {
   }
 }
 
-void Memoro_Traces(const v8::FunctionCallbackInfo<v8::Value>& args) {
-  Isolate* isolate = args.GetIsolate();
+void Memoro_SortTraces(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  DatasetId id = IdArg(args);
+  v8::String::Utf8Value sortByV8(args[1]);
+  std::string sortBy(*sortByV8, sortByV8.length());
 
-  size_t offset = args[0]->IntegerValue();
-  size_t count = std::min((size_t)args[1]->IntegerValue(), traces.size() - offset);
+  Supersede(IdArg(args), AsyncSort);
+  std::vector<TraceValue>& traces = sorted_traces[id];
+  traces.clear();
+  SortTraceValues(id, traces, sortBy);
+}
 
-  auto kTrace          = String::NewFromUtf8(isolate, "trace");
-  auto kType           = String::NewFromUtf8(isolate, "type");
-  auto kTraceIndex     = String::NewFromUtf8(isolate, "trace_index");
-  auto kNumChunks      = String::NewFromUtf8(isolate, "num_chunks");
-  auto kChunkIndex     = String::NewFromUtf8(isolate, "chunk_index");
-  auto kMaxAggregate   = String::NewFromUtf8(isolate, "max_aggregate");
-  auto kAllocTimeTotal = String::NewFromUtf8(isolate, "alloc_time_total");
-  auto kUsage          = String::NewFromUtf8(isolate, "usage_score");
-  auto kLifetime       = String::NewFromUtf8(isolate, "lifetime_score");
-  auto kUsefulLifetime = String::NewFromUtf8(isolate, "useful_lifetime_score");
+// args (id, sort by, callback). traces() pages the new order once the
+// callback ran
+void Memoro_SortTracesAsync(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  DatasetId id = IdArg(args);
+  v8::String::Utf8Value sortByV8(args[1]);
+  std::string sortBy(*sortByV8, sortByV8.length());
+
+  // sorted aside, the traces are read by the JS thread in the meantime
+  auto sorted = std::make_shared<std::vector<TraceValue>>();
+  QueueAsync(args, 2, id, AsyncSort,
+             [id, sorted, sortBy](const CancelFn& cancelled) {
+               SortTraceValues(id, *sorted, sortBy, cancelled);
+             },
+             [id, sorted](Isolate*, Local<Object>) {
+               sorted_traces[id].swap(*sorted);
+             });
+}
+
+// args (id, offset, count), all traces from offset if count is missing.
+// the trace text and type name are left out, see trace_text and type_names
+void Memoro_Traces(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  const std::vector<TraceValue>& traces = sorted_traces[IdArg(args)];
+
+  size_t offset = std::min((size_t)args[1]->IntegerValue(), traces.size());
+  size_t count = traces.size() - offset;
+  if (!args[2]->IsUndefined())
+    count = std::min((size_t)args[2]->IntegerValue(), count);
+
+  Columns columns(isolate, count,
+                  2 * sizeof(double) + 4 * sizeof(int32_t) + 3 * sizeof(float));
+  double* max_aggregate = columns.Add<double, Float64Array>("max_aggregate");
+  double* alloc_time_total =
+      columns.Add<double, Float64Array>("alloc_time_total");
+  int32_t* trace_index = columns.Add<int32_t, Int32Array>("trace_index");
+  uint32_t* type_id = columns.Add<uint32_t, Uint32Array>("type_id");
+  int32_t* num_chunks = columns.Add<int32_t, Int32Array>("num_chunks");
+  int32_t* chunk_index = columns.Add<int32_t, Int32Array>("chunk_index");
+  float* usage = columns.Add<float, Float32Array>("usage_score");
+  float* lifetime = columns.Add<float, Float32Array>("lifetime_score");
+  float* useful_lifetime =
+      columns.Add<float, Float32Array>("useful_lifetime_score");
 
-  Local<Array> result_list = Array::New(isolate);
   for (size_t i = 0; i < count; i++) {
     const TraceValue& t = traces[i + offset];
+    max_aggregate[i] = t.max_aggregate;
+    alloc_time_total[i] = t.alloc_time_total;
+    trace_index[i] = t.trace_index;
+    type_id[i] = t.type_id;
+    num_chunks[i] = t.num_chunks;
+    chunk_index[i] = t.chunk_index;
+    usage[i] = t.usage_score;
+    lifetime[i] = t.lifetime_score;
+    useful_lifetime[i] = t.useful_lifetime_score;
+  }
 
-    Local<Object> result = Object::New(isolate);
-    result->Set(kTrace, String::NewFromUtf8(isolate, t.trace->c_str()));
-    result->Set(kType, String::NewFromUtf8(isolate, t.type->c_str()));
-    result->Set(kTraceIndex, Number::New(isolate, t.trace_index));
-    result->Set(kNumChunks, Number::New(isolate, t.num_chunks));
-    result->Set(kChunkIndex, Number::New(isolate, t.chunk_index));
-    result->Set(kMaxAggregate, Number::New(isolate, t.max_aggregate));
-    result->Set(kAllocTimeTotal, Number::New(isolate, t.alloc_time_total));
-    result->Set(kUsage, Number::New(isolate, t.usage_score));
-    result->Set(kLifetime, Number::New(isolate, t.lifetime_score));
-    result->Set(kUsefulLifetime, Number::New(isolate, t.useful_lifetime_score));
+  args.GetReturnValue().Set(columns.Result());
+}
 
-    result_list->Set(i, result);
-  }
+void Memoro_TraceText(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  int trace_index = args[1]->NumberValue();
+  args.GetReturnValue().Set(
+      String::NewFromUtf8(isolate, TraceText(IdArg(args), trace_index).c_str()));
+}
 
+void Memoro_TypeNames(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  const std::vector<std::string>& types = TypeNames(IdArg(args));
+  Local<Array> result_list = Array::New(isolate, types.size());
+  for (size_t i = 0; i < types.size(); i++)
+    result_list->Set(i, String::NewFromUtf8(isolate, types[i].c_str()));
   args.GetReturnValue().Set(result_list);
 }
 
 void Memoro_MaxTime(const v8::FunctionCallbackInfo<v8::Value>& args) {
   Isolate* isolate = args.GetIsolate();
 
-  Local<Number> retval = v8::Number::New(isolate, MaxTime());
+  Local<Number> retval = v8::Number::New(isolate, MaxTime(IdArg(args)));
 
   args.GetReturnValue().Set(retval);
 }
@@ -265,7 +657,7 @@ void Memoro_MaxTime(const v8::FunctionCallbackInfo<v8::Value>& args) {
 void Memoro_MinTime(const v8::FunctionCallbackInfo<v8::Value>& args) {
   Isolate* isolate = args.GetIsolate();
 
-  Local<Number> retval = v8::Number::New(isolate, MinTime());
+  Local<Number> retval = v8::Number::New(isolate, MinTime(IdArg(args)));
 
   args.GetReturnValue().Set(retval);
 }
@@ -273,7 +665,7 @@ void Memoro_MinTime(const v8::FunctionCallbackInfo<v8::Value>& args) {
 void Memoro_FilterMaxTime(const v8::FunctionCallbackInfo<v8::Value>& args) {
   Isolate* isolate = args.GetIsolate();
 
-  Local<Number> retval = v8::Number::New(isolate, FilterMaxTime());
+  Local<Number> retval = v8::Number::New(isolate, FilterMaxTime(IdArg(args)));
 
   args.GetReturnValue().Set(retval);
 }
@@ -281,7 +673,7 @@ void Memoro_FilterMaxTime(const v8::FunctionCallbackInfo<v8::Value>& args) {
 void Memoro_FilterMinTime(const v8::FunctionCallbackInfo<v8::Value>& args) {
   Isolate* isolate = args.GetIsolate();
 
-  Local<Number> retval = v8::Number::New(isolate, FilterMinTime());
+  Local<Number> retval = v8::Number::New(isolate, FilterMinTime(IdArg(args)));
 
   args.GetReturnValue().Set(retval);
 }
@@ -289,7 +681,7 @@ void Memoro_FilterMinTime(const v8::FunctionCallbackInfo<v8::Value>& args) {
 void Memoro_MaxAggregate(const v8::FunctionCallbackInfo<v8::Value>& args) {
   Isolate* isolate = args.GetIsolate();
 
-  Local<Number> retval = v8::Number::New(isolate, MaxAggregate());
+  Local<Number> retval = v8::Number::New(isolate, MaxAggregate(IdArg(args)));
 
   args.GetReturnValue().Set(retval);
 }
@@ -297,48 +689,116 @@ void Memoro_MaxAggregate(const v8::FunctionCallbackInfo<v8::Value>& args) {
 void Memoro_GlobalAllocTime(const v8::FunctionCallbackInfo<v8::Value>& args) {
   Isolate* isolate = args.GetIsolate();
 
-  Local<Number> retval = v8::Number::New(isolate, GlobalAllocTime());
+  Local<Number> retval = v8::Number::New(isolate, GlobalAllocTime(IdArg(args)));
 
   args.GetReturnValue().Set(retval);
 }
 
+void Memoro_SetNumWorkers(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  unsigned num_workers = args[0]->NumberValue();
+  SetNumWorkers(num_workers);
+}
+
 void Memoro_SetTraceKeyword(const v8::FunctionCallbackInfo<v8::Value>& args) {
-  v8::String::Utf8Value s(args[0]);
+  v8::String::Utf8Value s(args[1]);
+  std::string keyword(*s);
+
+  SetTraceKeyword(IdArg(args), keyword);
+}
+
+void Memoro_SetTraceKeywordAsync(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  DatasetId id = IdArg(args);
+  v8::String::Utf8Value s(args[1]);
   std::string keyword(*s);
 
-  SetTraceKeyword(keyword);
+  QueueAsync(args, 2, id, AsyncTraceFilter,
+             [id, keyword](const CancelFn&) { SetTraceKeyword(id, keyword); },
+             nullptr,
+             false);
 }
 
 void Memoro_SetTypeKeyword(const v8::FunctionCallbackInfo<v8::Value>& args) {
-  v8::String::Utf8Value s(args[0]);
+  v8::String::Utf8Value s(args[1]);
   std::string keyword(*s);
 
-  SetTypeKeyword(keyword);
+  SetTypeKeyword(IdArg(args), keyword);
+}
+
+void Memoro_SetTypeKeywordAsync(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  DatasetId id = IdArg(args);
+  v8::String::Utf8Value s(args[1]);
+  std::string keyword(*s);
+
+  QueueAsync(args, 2, id, AsyncTypeFilter,
+             [id, keyword](const CancelFn&) { SetTypeKeyword(id, keyword); },
+             nullptr,
+             false);
 }
 
 void Memoro_SetFilterMinMax(const v8::FunctionCallbackInfo<v8::Value>& args) {
-  uint64_t t1 = args[0]->NumberValue();
-  uint64_t t2 = args[1]->NumberValue();
-  SetFilterMinMax(t1, t2);
+  uint64_t t1 = args[1]->NumberValue();
+  uint64_t t2 = args[2]->NumberValue();
+  Supersede(IdArg(args), AsyncTimeFilter);
+  SetFilterMinMax(IdArg(args), t1, t2);
+}
+
+// args (id, min, max, callback). while the window is dragged only the
+// last one set is applied
+void Memoro_SetFilterMinMaxAsync(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  DatasetId id = IdArg(args);
+  uint64_t t1 = args[1]->NumberValue();
+  uint64_t t2 = args[2]->NumberValue();
+  QueueAsync(args, 3, id, AsyncTimeFilter,
+             [id, t1, t2](const CancelFn&) { SetFilterMinMax(id, t1, t2); });
 }
 
 void Memoro_TraceFilterReset(const v8::FunctionCallbackInfo<v8::Value>& args) {
-  TraceFilterReset();
+  Supersede(IdArg(args), AsyncTraceFilter);
+  TraceFilterReset(IdArg(args));
+}
+
+// args (id, callback), keywords still queued are dropped
+void Memoro_TraceFilterResetAsync(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  DatasetId id = IdArg(args);
+  QueueAsync(args, 1, id, AsyncTraceFilter,
+             [id](const CancelFn&) { TraceFilterReset(id); });
 }
 
 void Memoro_TypeFilterReset(const v8::FunctionCallbackInfo<v8::Value>& args) {
-  TypeFilterReset();
+  Supersede(IdArg(args), AsyncTypeFilter);
+  TypeFilterReset(IdArg(args));
+}
+
+// args (id, callback), keywords still queued are dropped
+void Memoro_TypeFilterResetAsync(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  DatasetId id = IdArg(args);
+  QueueAsync(args, 1, id, AsyncTypeFilter,
+             [id](const CancelFn&) { TypeFilterReset(id); });
 }
 
 void Memoro_FilterMinMaxReset(const v8::FunctionCallbackInfo<v8::Value>& args) {
-  FilterMinMaxReset();
+  Supersede(IdArg(args), AsyncTimeFilter);
+  FilterMinMaxReset(IdArg(args));
+}
+
+// args (id, callback)
+void Memoro_FilterMinMaxResetAsync(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  DatasetId id = IdArg(args);
+  QueueAsync(args, 1, id, AsyncTimeFilter,
+             [id](const CancelFn&) { FilterMinMaxReset(id); });
 }
 
 void Memoro_Inefficiencies(const v8::FunctionCallbackInfo<v8::Value>& args) {
   Isolate* isolate = args.GetIsolate();
 
-  int trace_index = args[0]->NumberValue();
-  uint64_t i = Inefficiencies(trace_index);
+  int trace_index = args[1]->NumberValue();
+  uint64_t i = Inefficiencies(IdArg(args), trace_index);
 
   // there will be more here eventually, probably
   Local<Object> result = Object::New(isolate);
@@ -380,44 +840,289 @@ void Memoro_Inefficiencies(const v8::FunctionCallbackInfo<v8::Value>& args) {
 
 void Memoro_StackTree(const v8::FunctionCallbackInfo<v8::Value>& args) {
   // was hoping to keep all the V8 stuff in this file, oh well ..
-  StackTreeObject(args);
+  StackTreeObject(IdArg(args), args, 1);
+}
+
+void Memoro_StackTreeChildren(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  StackTreeChildren(IdArg(args), args, 1);
+}
+
+void Memoro_SetStackTreeTopK(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  double k = args[0]->NumberValue();
+  SetStackTreeTopK(k > 0 ? size_t(k) : 1);
+}
+
+// the stack tree metrics
+static std::function<double(const Trace* t)> BytesAt(uint64_t time) {
+  return [time](const Trace* t) -> double { return (double)LiveBytes(t, time); };
+}
+
+static double BytesTotal(const Trace* t) { return (double)t->bytes_total; }
+
+static double NumAllocs(const Trace* t) { return (double)t->chunks.size(); }
+
+static void StackTreeAggregateAsync(
+    const v8::FunctionCallbackInfo<v8::Value>& args, int callback_arg,
+    std::function<double(const Trace* t)> f) {
+  DatasetId id = IdArg(args);
+  QueueAsync(args, callback_arg, id, AsyncStackTree,
+             [id, f](const CancelFn& cancelled) {
+               StackTreeAggregate(id, f, cancelled);
+             });
 }
 
 void Memoro_StackTreeByBytes(const v8::FunctionCallbackInfo<v8::Value>& args) {
-  uint64_t time = args[0]->NumberValue();
-
-  StackTreeAggregate([time](const Trace* t) -> double {
-    auto it = find_if(t->aggregate.begin(), t->aggregate.end(),
-                      [time](const TimeValue& a) { return a.time >= time; });
-    if (it == t->aggregate.end()) {
-      // std::cout << "found no time";
-      return (double)0;
-    }
-    // take the prev value when our point was actually greater than the selected
-    // time
-    if (it != t->aggregate.begin() && it->time > time) it--;
-    // std::cout << "value is " << it->value << " at time " << it->time << " for
-    // trace " << t->trace << std::endl;
-    return (double)it->value;
-  });
+  uint64_t time = args[1]->NumberValue();
+
+  Supersede(IdArg(args), AsyncStackTree);
+  StackTreeAggregate(IdArg(args), BytesAt(time));
+}
+
+// args (id, time, callback), then stacktree() returns the tree by this
+// metric
+void Memoro_StackTreeByBytesAsync(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  uint64_t time = args[1]->NumberValue();
+  StackTreeAggregateAsync(args, 2, BytesAt(time));
+}
+
+void Memoro_LiveBytesDelta(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  uint64_t t1 = args[1]->NumberValue();
+  uint64_t t2 = args[2]->NumberValue();
+  std::vector<TraceDelta> deltas;
+  LiveBytesDelta(IdArg(args), deltas, t1, t2);
+
+  auto kTraceIndex = String::NewFromUtf8(isolate, "trace_index");
+  auto kDelta = String::NewFromUtf8(isolate, "delta");
+
+  Local<Array> result_list = Array::New(isolate);
+  for (unsigned int i = 0; i < deltas.size(); i++) {
+    Local<Object> result = Object::New(isolate);
+    result->Set(kTraceIndex, Number::New(isolate, deltas[i].trace_index));
+    result->Set(kDelta, Number::New(isolate, deltas[i].delta));
+    result_list->Set(i, result);
+  }
+
+  args.GetReturnValue().Set(result_list);
 }
 
 void Memoro_StackTreeByBytesTotal(const v8::FunctionCallbackInfo<v8::Value>& args) {
-  StackTreeAggregate(
-      [](const Trace* t) -> double {
-        return accumulate(t->chunks.begin(), t->chunks.end(), 0.0,
-          [](double sum, const Chunk* c) { return sum + c->size; });
-      });
+  Supersede(IdArg(args), AsyncStackTree);
+  StackTreeAggregate(IdArg(args), BytesTotal);
+}
+
+void Memoro_StackTreeByBytesTotalAsync(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  StackTreeAggregateAsync(args, 1, BytesTotal);
 }
 
 void Memoro_StackTreeByNumAllocs(
     const v8::FunctionCallbackInfo<v8::Value>& args) {
-  StackTreeAggregate(
-      [](const Trace* t) -> double { return (double)t->chunks.size(); });
+  Supersede(IdArg(args), AsyncStackTree);
+  StackTreeAggregate(IdArg(args), NumAllocs);
+}
+
+void Memoro_StackTreeByNumAllocsAsync(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  StackTreeAggregateAsync(args, 1, NumAllocs);
+}
+
+// args (id, path, metric, time): write the traces in collapsed stack format.
+// metric is one of "bytes" (live at time), "bytes_total", "numallocs" or
+// "alloc_time_total"
+void Memoro_ExportFolded(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  v8::String::Utf8Value p(args[1]);
+  std::string path(*p);
+  v8::String::Utf8Value m(args[2]);
+  std::string metric(*m);
+
+  std::function<uint64_t(const Trace* t)> f;
+  if (metric == "bytes") {
+    uint64_t time = args[3]->NumberValue();
+    f = [time](const Trace* t) -> uint64_t { return LiveBytes(t, time); };
+  } else if (metric == "bytes_total") {
+    f = [](const Trace* t) -> uint64_t { return t->bytes_total; };
+  } else if (metric == "numallocs") {
+    f = [](const Trace* t) -> uint64_t { return t->chunks.size(); };
+  } else if (metric == "alloc_time_total") {
+    f = [](const Trace* t) -> uint64_t { return t->alloc_time_total; };
+  }
+
+  std::string msg;
+  bool ok = false;
+  if (f)
+    ok = ExportFolded(IdArg(args), path, f, msg);
+  else
+    msg = "unknown metric " + metric;
+
+  Local<Object> result = Object::New(isolate);
+  result->Set(String::NewFromUtf8(isolate, "message"),
+              String::NewFromUtf8(isolate, msg.c_str()));
+  result->Set(String::NewFromUtf8(isolate, "result"),
+              Boolean::New(isolate, ok));
+  args.GetReturnValue().Set(result);
+}
+
+// the diff metrics, live bytes are left out as the two captures do not
+// share a timeline. null for an unknown metric
+static std::function<double(const Trace* t)> DiffMetric(
+    const std::string& metric) {
+  if (metric == "bytes_total") return BytesTotal;
+  if (metric == "numallocs") return NumAllocs;
+  if (metric == "alloc_time_total")
+    return [](const Trace* t) -> double { return (double)t->alloc_time_total; };
+  return nullptr;
+}
+
+// the last diff, its tree is paged by diff_children. JS thread only
+static std::shared_ptr<DatasetDiff> last_diff = std::make_shared<DatasetDiff>();
+
+// {traces, tree}: a row per call path in either dataset, the largest
+// change in the metric first, and the tree with both values per node. the
+// trace indexes are -1 for a path missing from a dataset, trace_text gets
+// their text
+static Local<Object> DiffObject(Isolate* isolate, const DatasetDiff& diff,
+                                size_t count, size_t depth) {
+  size_t n = diff.traces.size();
+  Columns columns(isolate, n,
+                  10 * sizeof(double) + 5 * sizeof(uint32_t) +
+                      6 * sizeof(float));
+  double* value_a = columns.Add<double, Float64Array>("value_a");
+  double* value_b = columns.Add<double, Float64Array>("value_b");
+  double* max_aggregate_a = columns.Add<double, Float64Array>("max_aggregate_a");
+  double* max_aggregate_b = columns.Add<double, Float64Array>("max_aggregate_b");
+  double* num_chunks_a = columns.Add<double, Float64Array>("num_chunks_a");
+  double* num_chunks_b = columns.Add<double, Float64Array>("num_chunks_b");
+  double* alloc_time_a = columns.Add<double, Float64Array>("alloc_time_total_a");
+  double* alloc_time_b = columns.Add<double, Float64Array>("alloc_time_total_b");
+  double* bytes_total_a = columns.Add<double, Float64Array>("bytes_total_a");
+  double* bytes_total_b = columns.Add<double, Float64Array>("bytes_total_b");
+  int32_t* trace_a = columns.Add<int32_t, Int32Array>("trace_a");
+  int32_t* trace_b = columns.Add<int32_t, Int32Array>("trace_b");
+  uint32_t* node = columns.Add<uint32_t, Uint32Array>("node");
+  uint32_t* added = columns.Add<uint32_t, Uint32Array>("inefficiencies_added");
+  uint32_t* removed =
+      columns.Add<uint32_t, Uint32Array>("inefficiencies_removed");
+  float* usage_a = columns.Add<float, Float32Array>("usage_score_a");
+  float* usage_b = columns.Add<float, Float32Array>("usage_score_b");
+  float* lifetime_a = columns.Add<float, Float32Array>("lifetime_score_a");
+  float* lifetime_b = columns.Add<float, Float32Array>("lifetime_score_b");
+  float* useful_lifetime_a =
+      columns.Add<float, Float32Array>("useful_lifetime_score_a");
+  float* useful_lifetime_b =
+      columns.Add<float, Float32Array>("useful_lifetime_score_b");
+
+  for (size_t i = 0; i < n; i++) {
+    const TraceDiff& d = diff.traces[i];
+    value_a[i] = d.value_a;
+    value_b[i] = d.value_b;
+    max_aggregate_a[i] = d.a.max_aggregate;
+    max_aggregate_b[i] = d.b.max_aggregate;
+    num_chunks_a[i] = d.a.num_chunks;
+    num_chunks_b[i] = d.b.num_chunks;
+    alloc_time_a[i] = d.a.alloc_time_total;
+    alloc_time_b[i] = d.b.alloc_time_total;
+    bytes_total_a[i] = d.a.bytes_total;
+    bytes_total_b[i] = d.b.bytes_total;
+    trace_a[i] = d.a.trace_index;
+    trace_b[i] = d.b.trace_index;
+    node[i] = d.node;
+    added[i] = d.inefficiencies_added;
+    removed[i] = d.inefficiencies_removed;
+    usage_a[i] = d.a.usage_score;
+    usage_b[i] = d.b.usage_score;
+    lifetime_a[i] = d.a.lifetime_score;
+    lifetime_b[i] = d.b.lifetime_score;
+    useful_lifetime_a[i] = d.a.useful_lifetime_score;
+    useful_lifetime_b[i] = d.b.useful_lifetime_score;
+  }
+
+  Local<Object> result = Object::New(isolate);
+  result->Set(String::NewFromUtf8(isolate, "traces"), columns.Result());
+  result->Set(String::NewFromUtf8(isolate, "tree"),
+              DiffTreeObject(isolate, diff, StackTreeTopK(), count, depth));
+  return result;
+}
+
+// args (id before, id after, metric, count, depth): compare the datasets,
+// see diff.h. metric is one of "bytes_total" (the default), "numallocs" or
+// "alloc_time_total", count and depth limit the tree like stacktree()
+void Memoro_DiffDatasets(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  DatasetId a = args[0]->Uint32Value();
+  DatasetId b = args[1]->Uint32Value();
+  std::string metric = "bytes_total";
+  if (args[2]->IsString()) metric = *v8::String::Utf8Value(args[2]);
+
+  Local<Object> result = Object::New(isolate);
+  std::string msg;
+  auto f = DiffMetric(metric);
+  auto diff = std::make_shared<DatasetDiff>();
+  bool ok = false;
+  Supersede(NO_DATASET, AsyncDiff);
+  if (f)
+    ok = DiffDatasets(a, b, f, *diff, msg);
+  else
+    msg = "unknown metric " + metric;
+  if (ok) {
+    last_diff = diff;
+    result->Set(String::NewFromUtf8(isolate, "diff"),
+                DiffObject(isolate, *diff, CountArg(args, 3), CountArg(args, 4)));
+  }
+  result->Set(String::NewFromUtf8(isolate, "message"),
+              String::NewFromUtf8(isolate, msg.c_str()));
+  result->Set(String::NewFromUtf8(isolate, "result"),
+              Boolean::New(isolate, ok));
+  args.GetReturnValue().Set(result);
+}
+
+// args (id before, id after, metric, count, depth, callback), the
+// callback argument has the diff_datasets result as "diff"
+void Memoro_DiffDatasetsAsync(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  DatasetId a = args[0]->Uint32Value();
+  DatasetId b = args[1]->Uint32Value();
+  std::string metric = "bytes_total";
+  if (args[2]->IsString()) metric = *v8::String::Utf8Value(args[2]);
+  size_t count = CountArg(args, 3);
+  size_t depth = CountArg(args, 4);
+
+  auto f = DiffMetric(metric);
+  auto diff = std::make_shared<DatasetDiff>();
+  auto msg = std::make_shared<std::string>();
+  auto ok = std::make_shared<bool>(false);
+  QueueAsync(args, 5, NO_DATASET, AsyncDiff,
+             [a, b, f, metric, diff, msg, ok](const CancelFn&) {
+               if (f)
+                 *ok = DiffDatasets(a, b, f, *diff, *msg);
+               else
+                 *msg = "unknown metric " + metric;
+             },
+             [diff, msg, ok, count, depth](Isolate* isolate,
+                                           Local<Object> result) {
+               result->Set(String::NewFromUtf8(isolate, "result"),
+                           Boolean::New(isolate, *ok));
+               result->Set(String::NewFromUtf8(isolate, "message"),
+                           String::NewFromUtf8(isolate, msg->c_str()));
+               if (!*ok) return;
+               last_diff = diff;
+               result->Set(String::NewFromUtf8(isolate, "diff"),
+                           DiffObject(isolate, *diff, count, depth));
+             });
+}
+
+// args (node id, offset, count), children of a node of the last diff tree
+void Memoro_DiffChildren(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  DiffTreeChildren(*last_diff, StackTreeTopK(), args, 0);
 }
 
 void init(Handle<Object> exports, Handle<Object> module) {
   NODE_SET_METHOD(exports, "set_dataset", Memoro_SetDataset);
+  NODE_SET_METHOD(exports, "load_dataset", Memoro_LoadDataset);
+  NODE_SET_METHOD(exports, "dataset_loaded", Memoro_DatasetLoaded);
+  NODE_SET_METHOD(exports, "close_dataset", Memoro_CloseDataset);
+  NODE_SET_METHOD(exports, "set_memory_budget", Memoro_SetMemoryBudget);
   NODE_SET_METHOD(exports, "aggregate_all", Memoro_AggregateAll);
   NODE_SET_METHOD(exports, "max_time", Memoro_MaxTime);
   NODE_SET_METHOD(exports, "min_time", Memoro_MinTime);
@@ -428,6 +1133,8 @@ void init(Handle<Object> exports, Handle<Object> module) {
   NODE_SET_METHOD(exports, "set_type_keyword", Memoro_SetTypeKeyword);
   NODE_SET_METHOD(exports, "sort_traces", Memoro_SortTraces);
   NODE_SET_METHOD(exports, "traces", Memoro_Traces);
+  NODE_SET_METHOD(exports, "trace_text", Memoro_TraceText);
+  NODE_SET_METHOD(exports, "type_names", Memoro_TypeNames);
   NODE_SET_METHOD(exports, "aggregate_trace", Memoro_AggregateTrace);
   NODE_SET_METHOD(exports, "trace_chunks", Memoro_TraceChunks);
   NODE_SET_METHOD(exports, "set_filter_minmax", Memoro_SetFilterMinMax);
@@ -436,11 +1143,39 @@ void init(Handle<Object> exports, Handle<Object> module) {
   NODE_SET_METHOD(exports, "filter_minmax_reset", Memoro_FilterMinMaxReset);
   NODE_SET_METHOD(exports, "inefficiencies", Memoro_Inefficiencies);
   NODE_SET_METHOD(exports, "global_alloc_time", Memoro_GlobalAllocTime);
+  NODE_SET_METHOD(exports, "set_num_workers", Memoro_SetNumWorkers);
   NODE_SET_METHOD(exports, "stacktree", Memoro_StackTree);
+  NODE_SET_METHOD(exports, "stacktree_children", Memoro_StackTreeChildren);
+  NODE_SET_METHOD(exports, "set_stacktree_top_k", Memoro_SetStackTreeTopK);
   NODE_SET_METHOD(exports, "stacktree_by_bytes", Memoro_StackTreeByBytes);
   NODE_SET_METHOD(exports, "stacktree_by_bytes_total", Memoro_StackTreeByBytesTotal);
   NODE_SET_METHOD(exports, "stacktree_by_numallocs",
                   Memoro_StackTreeByNumAllocs);
+  NODE_SET_METHOD(exports, "live_bytes_delta", Memoro_LiveBytesDelta);
+  NODE_SET_METHOD(exports, "export_folded", Memoro_ExportFolded);
+  NODE_SET_METHOD(exports, "diff_datasets", Memoro_DiffDatasets);
+  NODE_SET_METHOD(exports, "diff_children", Memoro_DiffChildren);
+  NODE_SET_METHOD(exports, "aggregate_all_async", Memoro_AggregateAllAsync);
+  NODE_SET_METHOD(exports, "sort_traces_async", Memoro_SortTracesAsync);
+  NODE_SET_METHOD(exports, "set_trace_keyword_async",
+                  Memoro_SetTraceKeywordAsync);
+  NODE_SET_METHOD(exports, "set_type_keyword_async",
+                  Memoro_SetTypeKeywordAsync);
+  NODE_SET_METHOD(exports, "stacktree_by_bytes_async",
+                  Memoro_StackTreeByBytesAsync);
+  NODE_SET_METHOD(exports, "stacktree_by_bytes_total_async",
+                  Memoro_StackTreeByBytesTotalAsync);
+  NODE_SET_METHOD(exports, "stacktree_by_numallocs_async",
+                  Memoro_StackTreeByNumAllocsAsync);
+  NODE_SET_METHOD(exports, "diff_datasets_async", Memoro_DiffDatasetsAsync);
+  NODE_SET_METHOD(exports, "set_filter_minmax_async",
+                  Memoro_SetFilterMinMaxAsync);
+  NODE_SET_METHOD(exports, "filter_minmax_reset_async",
+                  Memoro_FilterMinMaxResetAsync);
+  NODE_SET_METHOD(exports, "trace_filter_reset_async",
+                  Memoro_TraceFilterResetAsync);
+  NODE_SET_METHOD(exports, "type_filter_reset_async",
+                  Memoro_TypeFilterResetAsync);
 }
 
 NODE_MODULE(memoro, init)
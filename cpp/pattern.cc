@@ -17,6 +17,8 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <tuple>
+#include <utility>
 
 namespace memoro {
 
@@ -32,195 +34,372 @@ using namespace std;
 
 bool HasInefficiency(uint64_t bitvec, Inefficiency i) { return bool(bitvec & i); }
 
-float UsageScore(std::vector<Chunk*> const& chunks) {
-  double sum = 0;
-  uint64_t total_bytes = 0;
-  for (auto chunk : chunks) {
-    if (chunk->num_writes == 0 && chunk->num_reads == 0) { 
-      continue;
-    }
-    sum += double(chunk->access_interval_high - chunk->access_interval_low);
-    total_bytes += chunk->size;
-  }
-  if (sum == 0){
-    return 0;
-  }
-  return float(sum) / float(total_bytes);
-}
+// chunks are handed to the detectors in blocks of this many, small enough
+// that the columns read by one detector are still in L1 for the next
+#define SCAN_BLOCK 256u
 
-// divide chunks into groups (regions) where region boundaries are defined by
-// `threshold`. If chunk N and chunk N+1 are separated by more than `threshold`,
-// they are in different regions.
-float LifetimeScore(std::vector<Chunk*> const& chunks, uint64_t threshold) {
-  // we avoid `memorizing' regions right now, but may add in the future
-  // if we want to annotate in the gui
-  double current_lifetime_sum = 0;
-  uint32_t current_num_chunks = 0;
-  uint64_t region_start_time = chunks[0]->timestamp_start;
-  uint64_t region_end_time = chunks[0]->timestamp_end;
-  double region_score_total = 0;
-  uint32_t num_regions = 0;
-  Chunk* prev = nullptr;
-  for (auto chunk : chunks) {
-    if (prev != nullptr && chunk->timestamp_start - prev->timestamp_start > threshold) {
-      // finish this region
-      if (prev->timestamp_end > region_end_time) {
-        region_end_time = prev->timestamp_end;
-      }
-      uint64_t region_lifetime = region_end_time - region_start_time;
-      double chunk_avg_lifetime =
-          current_lifetime_sum / double(current_num_chunks);
-      region_score_total += chunk_avg_lifetime / double(region_lifetime);
-      num_regions++;
-
-      // start a new one
-      current_num_chunks = 0;
-      current_lifetime_sum = 0;
-      region_start_time = chunk->timestamp_start;
-      region_end_time = chunk->timestamp_end;
-    }
-    current_lifetime_sum += chunk->timestamp_end - chunk->timestamp_start;
-    current_num_chunks++;
-    if (chunk->timestamp_end > region_end_time) {
-      region_end_time = chunk->timestamp_end;
+// raw column pointers, so stores to the accumulators do not force reloads
+struct Columns {
+  explicit Columns(const ChunkStore& c)
+      : size(c.size.data()),
+        start(c.timestamp_start.data()),
+        end(c.timestamp_end.data()),
+        first(c.timestamp_first_access.data()),
+        last(c.timestamp_last_access.data()),
+        alloc_call_time(c.alloc_call_time.data()),
+        low(c.access_interval_low.data()),
+        high(c.access_interval_high.data()),
+        reads(c.num_reads.data()),
+        writes(c.num_writes.data()),
+        multi_thread(c.multi_thread.data()) {}
+
+  const uint64_t* size;
+  const uint64_t* start;
+  const uint64_t* end;
+  const uint64_t* first;
+  const uint64_t* last;
+  const uint64_t* alloc_call_time;
+  const uint32_t* low;
+  const uint32_t* high;
+  const uint8_t* reads;
+  const uint8_t* writes;
+  const uint8_t* multi_thread;
+};
+
+struct ScanContext {
+  Columns columns;
+  const PatternParams& params;
+  uint64_t lifetime_threshold;
+};
+
+// A detector sees the chunks of one trace in order, a block at a time,
+// and writes what it found into the TraceScan at the end:
+//
+//   void Add(const ScanContext& ctx, uint32_t begin, uint32_t end);
+//   void Finish(const ScanContext& ctx, ChunkRange range, TraceScan& scan);
+//
+// per block loops without branches or state carried from chunk to chunk
+// vectorize (see SCAN_KERNEL), so keep sequential checks in their own
+// detector. accumulating in locals and storing once per block helps too.
+
+// alloc_time_total and bytes_total
+struct TotalsDetector {
+  uint64_t alloc_time_total = 0;
+  uint64_t bytes_total = 0;
+
+  void Add(const ScanContext& ctx, uint32_t begin, uint32_t end) {
+    const Columns& c = ctx.columns;
+    uint64_t alloc_time = 0, bytes = 0;
+    for (uint32_t i = begin; i < end; i++) {
+      alloc_time += c.alloc_call_time[i];
+      bytes += c.size[i];
     }
-    prev = chunk;
+    alloc_time_total += alloc_time;
+    bytes_total += bytes;
   }
 
-  // finish up last region
-  if (prev->timestamp_end > region_end_time) {
-    region_end_time = prev->timestamp_end;
+  void Finish(const ScanContext&, ChunkRange, TraceScan& scan) {
+    scan.alloc_time_total = alloc_time_total;
+    scan.bytes_total = bytes_total;
   }
-  uint64_t region_lifetime = region_end_time - region_start_time;
-  double chunk_avg_lifetime = current_lifetime_sum / double(current_num_chunks);
-  region_score_total += chunk_avg_lifetime / double(region_lifetime);
-  num_regions++;
+};
 
-  return region_score_total / num_regions;
-}
+// ShortLifetime, Unused/ReadOnly/WriteOnly, EarlyAlloc, LateFree and
+// MultiThread, all 64 bit integer compares
+struct TimeDetector {
+  uint64_t min_lifetime = UINT64_MAX;
+  uint64_t total_reads = 0, total_writes = 0;
+  uint8_t has_early_alloc = 0, has_late_free = 0;
+  uint8_t has_multi_thread = 0;
 
-float UsefulLifetimeScore(std::vector<Chunk*> const& chunks) {
-  double score_sum = 0;
-  for (auto chunk : chunks) {
-    uint64_t total_life = chunk->timestamp_end - chunk->timestamp_start;
-    uint64_t active_life =
-        chunk->timestamp_last_access - chunk->timestamp_first_access;
-    score_sum += double(active_life) / double(total_life);
+  void Add(const ScanContext& ctx, uint32_t begin, uint32_t end) {
+    const Columns& c = ctx.columns;
+    uint64_t min = min_lifetime;
+    uint64_t reads = 0, writes = 0;
+    // flags are or-ed together instead of branched on
+    uint8_t early_alloc = 0, late_free = 0, multi_thread = 0;
+    for (uint32_t i = begin; i < end; i++) {
+      // min lifetime
+      uint64_t diff = c.end[i] - c.start[i];
+      min = diff < min ? diff : min;
+
+      // total reads, writes
+      reads += c.reads[i];
+      writes += c.writes[i];
+
+      // late free
+      early_alloc |= c.first[i] - c.start[i] > diff / 2;
+
+      // early alloc
+      late_free |= c.end[i] - c.last[i] > diff / 2;
+
+      // multithread
+      multi_thread |= c.multi_thread[i];
+    }
+    min_lifetime = min;
+    total_reads += reads;
+    total_writes += writes;
+    has_early_alloc |= early_alloc;
+    has_late_free |= late_free;
+    has_multi_thread |= multi_thread;
   }
-  return score_sum / chunks.size();
-}
 
-float ReallocScore(std::vector<Chunk*> const& chunks) {
-  uint64_t last_size = 0;
-  unsigned int current_run = 0, longest_run = 0;
-  for (auto chunk : chunks) {
-    if (last_size == 0) {
-      last_size = chunk->size;
-      current_run++;
-    } else {
-      if (chunk->size >= last_size) {
-        last_size = chunk->size;
-        current_run++;
+  void Finish(const ScanContext& ctx, ChunkRange, TraceScan& scan) {
+    uint64_t& i = scan.inefficiencies;
+    if (min_lifetime <= ctx.params.short_lifetime) {
+      i |= Inefficiency::ShortLifetime;
+    }
+    if (total_reads == 0 || total_writes == 0) {
+      if (total_writes > 0) {
+        i |= Inefficiency::WriteOnly;
+      } else if (total_reads > 0) {
+        i |= Inefficiency::ReadOnly;
       } else {
-        longest_run = current_run > longest_run ? current_run : longest_run;
-        current_run = 0;
-        last_size = chunk->size;
+        i |= Inefficiency::Unused;
       }
     }
+    if (has_early_alloc) {
+      i |= Inefficiency::EarlyAlloc;
+    }
+    if (has_late_free) {
+      i |= Inefficiency::LateFree;
+    }
+    if (has_multi_thread) {
+      i |= Inefficiency::MultiThread;
+    }
   }
-  return 0.0f;
-}
+};
 
-uint64_t Detect(std::vector<Chunk*> const& chunks, const PatternParams& params) {
-  uint64_t min_lifetime = UINT64_MAX;
-  unsigned int total_reads = 0, total_writes = 0;
-  bool has_early_alloc = false, has_late_free = false;
-  bool has_multi_thread = false;
+// usage score and LowAccessCoverage
+struct AccessDetector {
+  uint64_t sum = 0;
+  uint64_t total_bytes = 0;
   bool has_low_access_coverage = false;
-  uint64_t last_size = 0;
-  unsigned int current_run = 0, longest_run = 0;
 
-  for (auto chunk : chunks) {
-    // min lifetime
-    uint64_t diff = chunk->timestamp_end - chunk->timestamp_start;
-    if (diff < min_lifetime) {
-      min_lifetime = diff;
+  void Add(const ScanContext& ctx, uint32_t begin, uint32_t end) {
+    const Columns& c = ctx.columns;
+    // the interval widths are 32 bit, an integer sum is exact where the
+    // double sum would be too
+    uint64_t width = 0, bytes = 0;
+    for (uint32_t i = begin; i < end; i++) {
+      bool accessed = (c.reads[i] | c.writes[i]) != 0;
+      width += accessed ? uint32_t(c.high[i] - c.low[i]) : 0;
+      bytes += accessed ? c.size[i] : 0;
     }
+    sum += width;
+    total_bytes += bytes;
 
-    // total reads, writes
-    total_reads += chunk->num_reads;
-    total_writes += chunk->num_writes;
-
-    // late free
-    if (chunk->timestamp_first_access - chunk->timestamp_start >
-        (chunk->timestamp_end - chunk->timestamp_start) / 2) {
-      has_early_alloc = true;
+    // 64 bit sizes only convert to float one at a time, so this check
+    // gets its own loop over the same (cached) block
+    for (uint32_t i = begin; i < end && !has_low_access_coverage; i++) {
+      has_low_access_coverage = float(c.high[i] - c.low[i]) / float(c.size[i]) <
+                                ctx.params.access_coverage;
     }
+  }
 
-    // early alloc
-    if (chunk->timestamp_end - chunk->timestamp_last_access >
-        (chunk->timestamp_end - chunk->timestamp_start) / 2) {
-      has_late_free = true;
+  void Finish(const ScanContext&, ChunkRange, TraceScan& scan) {
+    scan.usage_score = sum == 0 ? 0 : float(double(sum)) / float(total_bytes);
+    if (has_low_access_coverage) {
+      scan.inefficiencies |= Inefficiency::LowAccessCoverage;
     }
+  }
+};
+
+// IncreasingReallocs, the longest run of non decreasing sizes
+struct SizeRunDetector {
+  uint64_t last_size = 0;
+  unsigned int current_run = 0, longest_run = 0;
 
-    // increasing alloc sizes
-    if (last_size == 0) {
-      last_size = chunk->size;
-      current_run++;
-    } else {
-      if (chunk->size >= last_size) {
-        last_size = chunk->size;
+  void Add(const ScanContext& ctx, uint32_t begin, uint32_t end) {
+    const uint64_t* size = ctx.columns.size;
+    for (uint32_t i = begin; i < end; i++) {
+      if (last_size == 0) {
+        last_size = size[i];
         current_run++;
       } else {
-        longest_run = current_run > longest_run ? current_run : longest_run;
-        current_run = 0;
-        last_size = chunk->size;
+        if (size[i] >= last_size) {
+          last_size = size[i];
+          current_run++;
+        } else {
+          longest_run = current_run > longest_run ? current_run : longest_run;
+          current_run = 0;
+          last_size = size[i];
+        }
       }
     }
-    // multithread
-    if (bool(chunk->multi_thread)) {
-      has_multi_thread = true;
+  }
+
+  void Finish(const ScanContext& ctx, ChunkRange, TraceScan& scan) {
+    if (longest_run >= ctx.params.alloc_min_run) {
+      scan.inefficiencies |= Inefficiency::IncreasingReallocs;
     }
+  }
+};
 
-    if (float(chunk->access_interval_high - chunk->access_interval_low) /
-            float(chunk->size) <
-        params.access_coverage) {
-      has_low_access_coverage = true;
+// lifetime score. divide chunks into groups (regions) where region
+// boundaries are defined by `threshold`. If chunk N and chunk N+1 are
+// separated by more than `threshold`, they are in different regions.
+// we avoid `memorizing' regions right now, but may add in the future
+// if we want to annotate in the gui
+struct LifetimeDetector {
+  double current_lifetime_sum = 0;
+  uint32_t current_num_chunks = 0;
+  uint64_t region_start_time = 0;
+  uint64_t region_end_time = 0;
+  uint64_t prev_start = 0;
+  double region_score_total = 0;
+  uint32_t num_regions = 0;
+
+  void FinishRegion() {
+    uint64_t region_lifetime = region_end_time - region_start_time;
+    double chunk_avg_lifetime =
+        current_lifetime_sum / double(current_num_chunks);
+    region_score_total += chunk_avg_lifetime / double(region_lifetime);
+    num_regions++;
+  }
+
+  void Add(const ScanContext& ctx, uint32_t begin, uint32_t end) {
+    const uint64_t* start = ctx.columns.start;
+    const uint64_t* stop = ctx.columns.end;
+    for (uint32_t i = begin; i < end; i++) {
+      if (current_num_chunks == 0 ||
+          start[i] - prev_start > ctx.lifetime_threshold) {
+        // finish this region and start a new one
+        if (current_num_chunks > 0) FinishRegion();
+        current_num_chunks = 0;
+        current_lifetime_sum = 0;
+        region_start_time = start[i];
+        region_end_time = stop[i];
+      }
+      current_lifetime_sum += stop[i] - start[i];
+      current_num_chunks++;
+      if (stop[i] > region_end_time) {
+        region_end_time = stop[i];
+      }
+      prev_start = start[i];
     }
   }
 
-  uint64_t i = 0;
-  if (min_lifetime <= params.short_lifetime) {
-    i |= Inefficiency::ShortLifetime;
+  void Finish(const ScanContext&, ChunkRange range, TraceScan& scan) {
+    if (range.empty()) return;
+    // finish up last region
+    FinishRegion();
+    scan.lifetime_score = region_score_total / num_regions;
   }
-  if (total_reads == 0 || total_writes == 0) {
-    if (total_writes > 0) {
-      i |= Inefficiency::WriteOnly;
-    } else if (total_reads > 0) {
-      i |= Inefficiency::ReadOnly;
-    } else {
-      i |= Inefficiency::Unused;
+};
+
+// useful lifetime score, the fraction of its life a chunk is accessed
+struct UsefulLifetimeDetector {
+  double score_sum = 0;
+
+  void Add(const ScanContext& ctx, uint32_t begin, uint32_t end) {
+    const Columns& c = ctx.columns;
+    // kept in chunk order, so not vectorized
+    for (uint32_t i = begin; i < end; i++) {
+      uint64_t total_life = c.end[i] - c.start[i];
+      uint64_t active_life = c.last[i] - c.first[i];
+      score_sum += double(active_life) / double(total_life);
     }
   }
 
-  if (has_early_alloc) {
-    i |= Inefficiency::EarlyAlloc;
+  void Finish(const ScanContext&, ChunkRange range, TraceScan& scan) {
+    scan.useful_lifetime_score = score_sum / range.size();
+  }
+};
+
+// runs a list of detectors over the same blocks
+template <typename... Detectors>
+class DetectorSet {
+ public:
+  void Add(const ScanContext& ctx, uint32_t begin, uint32_t end) {
+    AddAll(ctx, begin, end, index_sequence_for<Detectors...>());
   }
-  if (has_late_free) {
-    i |= Inefficiency::LateFree;
+  void Finish(const ScanContext& ctx, ChunkRange range, TraceScan& scan) {
+    FinishAll(ctx, range, scan, index_sequence_for<Detectors...>());
   }
 
-  if (longest_run >= params.alloc_min_run) {
-    i |= Inefficiency::IncreasingReallocs;
+ private:
+  // no fold expressions in C++14, expand into an array instead
+  template <size_t... I>
+  void AddAll(const ScanContext& ctx, uint32_t begin, uint32_t end,
+              index_sequence<I...>) {
+    int expand[] = {0, (get<I>(detectors_).Add(ctx, begin, end), 0)...};
+    (void)expand;
   }
-  if (has_multi_thread) {
-    i |= Inefficiency::MultiThread;
+  template <size_t... I>
+  void FinishAll(const ScanContext& ctx, ChunkRange range, TraceScan& scan,
+                 index_sequence<I...>) {
+    int expand[] = {0, (get<I>(detectors_).Finish(ctx, range, scan), 0)...};
+    (void)expand;
   }
-  if (has_low_access_coverage) {
-    i |= Inefficiency::LowAccessCoverage;
+
+  tuple<Detectors...> detectors_;
+};
+
+// everything ScanTrace runs. a new check is a new detector struct above
+// added to this list, it does not need another pass over the chunks
+using TraceDetectors =
+    DetectorSet<TotalsDetector, TimeDetector, AccessDetector, SizeRunDetector,
+                LifetimeDetector, UsefulLifetimeDetector>;
+
+template <typename Set>
+static inline __attribute__((always_inline)) void RunDetectors(
+    const ChunkStore& chunks, ChunkRange range, const PatternParams& params,
+    uint64_t lifetime_threshold, TraceScan& scan) {
+  ScanContext ctx{Columns(chunks), params, lifetime_threshold};
+  Set detectors;
+  for (uint32_t begin = range.begin; begin < range.end; begin += SCAN_BLOCK) {
+    uint32_t end = range.end - begin > SCAN_BLOCK ? begin + SCAN_BLOCK
+                                                  : range.end;
+    detectors.Add(ctx, begin, end);
   }
+  scan = TraceScan();
+  detectors.Finish(ctx, range, scan);
+}
+
+SCAN_KERNEL
+void ScanTrace(const ChunkStore& chunks, ChunkRange range,
+               const PatternParams& params, uint64_t lifetime_threshold,
+               TraceScan& scan) {
+  RunDetectors<TraceDetectors>(chunks, range, params, lifetime_threshold,
+                               scan);
+}
+
+// the single score functions run just the detectors they need, each is
+// its own pass over the chunks
+
+SCAN_KERNEL
+float UsageScore(const ChunkStore& chunks, ChunkRange range) {
+  TraceScan scan;
+  RunDetectors<DetectorSet<AccessDetector>>(chunks, range, PatternParams(), 0,
+                                            scan);
+  return scan.usage_score;
+}
+
+SCAN_KERNEL
+float LifetimeScore(const ChunkStore& chunks, ChunkRange range,
+                    uint64_t threshold) {
+  TraceScan scan;
+  RunDetectors<DetectorSet<LifetimeDetector>>(chunks, range, PatternParams(),
+                                              threshold, scan);
+  return scan.lifetime_score;
+}
+
+SCAN_KERNEL
+float UsefulLifetimeScore(const ChunkStore& chunks, ChunkRange range) {
+  TraceScan scan;
+  RunDetectors<DetectorSet<UsefulLifetimeDetector>>(
+      chunks, range, PatternParams(), 0, scan);
+  return scan.useful_lifetime_score;
+}
 
-  return i;
+SCAN_KERNEL
+uint64_t Detect(const ChunkStore& chunks, ChunkRange range,
+                const PatternParams& params) {
+  TraceScan scan;
+  RunDetectors<DetectorSet<TimeDetector, AccessDetector, SizeRunDetector>>(
+      chunks, range, params, 0, scan);
+  return scan.inefficiencies;
 }
 
 void CalculatePercentilesChunk(std::vector<Trace>& traces,
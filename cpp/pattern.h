@@ -15,6 +15,7 @@
 
 #pragma once
 
+#include "chunkstore.h"
 #include "memoro.h"
 #include <vector>
 
@@ -44,13 +45,36 @@ struct PatternParams {
 
 bool HasInefficiency(uint64_t bitvec, Inefficiency i);
 
-float UsageScore(std::vector<Chunk*> const& chunks);
+// the kernels below scan the columns of chunks in range, which are the
+// chunks of one trace
+
+float UsageScore(const ChunkStore& chunks, ChunkRange range);
 // threshold typically 1% of program lifetime
-float LifetimeScore(std::vector<Chunk*> const& chunks, uint64_t threshold);
-float UsefulLifetimeScore(std::vector<Chunk*> const& chunks);
+float LifetimeScore(const ChunkStore& chunks, ChunkRange range,
+                    uint64_t threshold);
+float UsefulLifetimeScore(const ChunkStore& chunks, ChunkRange range);
 
 // returns bit vector of inefficiency
-uint64_t Detect(std::vector<Chunk*> const& chunks, const PatternParams& params);
+uint64_t Detect(const ChunkStore& chunks, ChunkRange range,
+                const PatternParams& params);
+
+// everything the load computes per trace from its chunks
+struct TraceScan {
+  uint64_t inefficiencies = 0;
+  uint64_t alloc_time_total = 0;
+  uint64_t bytes_total = 0;
+  float usage_score = 0;
+  float lifetime_score = 0;
+  float useful_lifetime_score = 0;
+};
+
+// Detect, the three scores and the per trace totals in a single pass over
+// the chunks, giving the same results as calling each of them. see the
+// detector list in pattern.cc for adding new checks to the pass.
+// lifetime_threshold is the LifetimeScore region threshold
+void ScanTrace(const ChunkStore& chunks, ChunkRange range,
+               const PatternParams& params, uint64_t lifetime_threshold,
+               TraceScan& scan);
 
 // mutates traces vector elements
 // requires sorted traces by num chunks
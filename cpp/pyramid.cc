@@ -0,0 +1,153 @@
+//===-- pyramid.cc ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#include "pyramid.h"
+#include <algorithm>
+
+namespace memoro {
+
+using namespace std;
+
+// the finest level has blocks of 2^PYRAMID_BASE points, shorter runs are
+// scanned directly. keeps the index at an eighth of the series size
+#define PYRAMID_BASE 4
+#define PYRAMID_BLOCK (1ul << PYRAMID_BASE)
+
+// fold the extrema (min, max) into acc, ties go to the earlier point
+static inline void Take(const TimeValue* p, Extrema& acc, uint32_t min,
+                        uint32_t max) {
+  if (p[min].value < p[acc.min].value ||
+      (p[min].value == p[acc.min].value && min < acc.min))
+    acc.min = min;
+  if (p[max].value > p[acc.max].value ||
+      (p[max].value == p[acc.max].value && max < acc.max))
+    acc.max = max;
+}
+
+static inline void Scan(const TimeValue* p, Extrema& acc, size_t begin,
+                        size_t end) {
+  for (size_t i = begin; i < end; i++) Take(p, acc, i, i);
+}
+
+void MinMaxPyramid::Build(const vector<TimeValue>& points) {
+  built_ = true;
+  const TimeValue* p = points.data();
+  size_t blocks = points.size() >> PYRAMID_BASE;
+  size_t num_levels = 0;
+  for (size_t b = blocks; b > 0; b >>= 1) num_levels++;
+  // rebuilt after every aggregate update, keep the level buffers
+  levels_.resize(num_levels);
+  if (blocks == 0) return;
+
+  vector<Extrema>& level = levels_[0];
+  level.resize(blocks);
+  for (size_t j = 0; j < blocks; j++) {
+    size_t begin = j << PYRAMID_BASE;
+    Extrema e = {uint32_t(begin), uint32_t(begin)};
+    Scan(p, e, begin + 1, begin + PYRAMID_BLOCK);
+    level[j] = e;
+  }
+
+  for (size_t k = 1; k < num_levels; k++) {
+    const vector<Extrema>& prev = levels_[k - 1];
+    vector<Extrema>& next = levels_[k];
+    next.resize(prev.size() / 2);
+    for (size_t j = 0; j < next.size(); j++) {
+      Extrema e = prev[2 * j];
+      Take(p, e, prev[2 * j + 1].min, prev[2 * j + 1].max);
+      next[j] = e;
+    }
+  }
+}
+
+Extrema MinMaxPyramid::MinMax(const vector<TimeValue>& points, size_t begin,
+                              size_t end) const {
+  const TimeValue* p = points.data();
+  Extrema acc = {uint32_t(begin), uint32_t(begin)};
+  size_t first = (begin + PYRAMID_BLOCK - 1) >> PYRAMID_BASE;
+  size_t last = end >> PYRAMID_BASE;
+  if (levels_.empty() || first >= last) {
+    Scan(p, acc, begin + 1, end);
+    return acc;
+  }
+
+  // the unaligned ends directly, the whole blocks in between from the
+  // coarsest levels that fit
+  Scan(p, acc, begin + 1, first << PYRAMID_BASE);
+  Scan(p, acc, last << PYRAMID_BASE, end);
+  for (size_t k = 0; first < last; k++) {
+    const vector<Extrema>& level = levels_[k];
+    if (first & 1) {
+      Take(p, acc, level[first].min, level[first].max);
+      first++;
+    }
+    if (last & 1) {
+      last--;
+      Take(p, acc, level[last].min, level[last].max);
+    }
+    first >>= 1;
+    last >>= 1;
+  }
+  return acc;
+}
+
+void SampleMinMax(const vector<TimeValue>& points,
+                  const MinMaxPyramid& pyramid, uint64_t min_time,
+                  uint64_t max_time, unsigned int num_bins,
+                  vector<TimeValue>& values) {
+  values.clear();
+  if (points.empty()) return;
+
+  auto before = [](const TimeValue& p, uint64_t time) { return p.time < time; };
+  auto after = [](uint64_t time, const TimeValue& p) { return time < p.time; };
+  size_t lo =
+      lower_bound(points.begin(), points.end(), min_time, before) - points.begin();
+  size_t hi =
+      upper_bound(points.begin() + lo, points.end(), max_time, after) -
+      points.begin();
+
+  values.reserve(min<size_t>(hi - lo, num_bins * 3) + 2);
+  // what was live when the window opens
+  values.push_back({min_time, points[lo == 0 ? 0 : lo - 1].value});
+
+  if (hi - lo <= 2 * num_bins) {
+    values.insert(values.end(), points.begin() + lo, points.begin() + hi);
+  } else {
+    uint64_t span = max_time - min_time;
+    size_t bin_begin = lo;
+    for (unsigned int b = 0; b < num_bins; b++) {
+      size_t bin_end = hi;
+      if (b + 1 < num_bins) {
+        uint64_t bin_time = min_time + uint64_t(double(span) * (b + 1) / num_bins);
+        bin_end = lower_bound(points.begin() + bin_begin, points.begin() + hi,
+                              bin_time, before) -
+                  points.begin();
+      }
+      if (bin_end > bin_begin) {
+        Extrema e = pyramid.MinMax(points, bin_begin, bin_end);
+        size_t picks[3] = {e.min, e.max, bin_end - 1};
+        sort(picks, picks + 3);
+        for (int i = 0; i < 3; i++)
+          if (i == 0 || picks[i] != picks[i - 1])
+            values.push_back(points[picks[i]]);
+      }
+      bin_begin = bin_end;
+    }
+  }
+
+  if (values.back().time < max_time)
+    values.push_back({max_time, values.back().value});
+}
+
+}  // namespace memoro
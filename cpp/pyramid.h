@@ -0,0 +1,72 @@
+//===-- pyramid.h ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "memoro.h"
+
+namespace memoro {
+
+// indexes of the smallest and largest value in a run of points
+struct Extrema {
+  uint32_t min;
+  uint32_t max;
+};
+
+// Level of detail index over an aggregate series, for drawing it at any
+// zoom without dropping peaks.
+//
+// level k holds the Extrema of every aligned block of 2^(k + base) points,
+// base skipping the smallest blocks to keep the index at a fraction of
+// the series size. the last value of a block needs no index, it is just
+// the point before the next block. MinMax of any range of points then
+// combines O(log n) blocks.
+class MinMaxPyramid {
+ public:
+  void Build(const std::vector<TimeValue>& points);
+  void Clear() {
+    levels_.clear();
+    built_ = false;
+  }
+  bool Built() const { return built_; }
+  size_t Bytes() const {
+    size_t bytes = VectorBytes(levels_);
+    for (auto& level : levels_) bytes += VectorBytes(level);
+    return bytes;
+  }
+
+  // Extrema of points[begin, end), which must not be empty. ties go to
+  // the earliest point. points must be the series the pyramid was built on
+  Extrema MinMax(const std::vector<TimeValue>& points, size_t begin,
+                 size_t end) const;
+
+ private:
+  std::vector<std::vector<Extrema>> levels_;
+  bool built_ = false;
+};
+
+// Downsample the part of points (sorted by time) between min_time and
+// max_time into at most num_bins equal time bins. each bin contributes its
+// min, max and last point in time order, so the curve keeps every peak
+// and the level it leaves each bin at. the result starts at min_time with
+// the value before the window and ends at max_time. windows with at most
+// 2 * num_bins points are returned as they are.
+void SampleMinMax(const std::vector<TimeValue>& points,
+                  const MinMaxPyramid& pyramid, uint64_t min_time,
+                  uint64_t max_time, unsigned int num_bins,
+                  std::vector<TimeValue>& values);
+
+}  // namespace memoro
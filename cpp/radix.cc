@@ -0,0 +1,126 @@
+//===-- radix.cc ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#include "radix.h"
+#include <algorithm>
+
+namespace memoro {
+
+using namespace std;
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PASSES (64 / RADIX_BITS)
+// below this many keys per block the pool is not worth it
+#define RADIX_MIN_BLOCK 65536ul
+
+using Histogram = vector<size_t>;
+
+static inline size_t Digit(uint64_t key, int d) {
+  return (key >> (d * RADIX_BITS)) & (RADIX_BUCKETS - 1);
+}
+
+bool RadixSort(ThreadPool& pool, vector<uint64_t>& keys,
+               vector<uint32_t>& values, const CancelFn& cancelled) {
+  size_t n = keys.size();
+  if (n < 2) return true;
+
+  size_t num_blocks = min<size_t>(pool.NumThreads(), n / RADIX_MIN_BLOCK);
+  if (num_blocks == 0) num_blocks = 1;
+  size_t block_size = (n + num_blocks - 1) / num_blocks;
+  num_blocks = (n + block_size - 1) / block_size;
+
+  // one histogram per digit per block, all taken in a single read
+  vector<Histogram> counts(num_blocks,
+                           Histogram(RADIX_PASSES * RADIX_BUCKETS, 0));
+  pool.ParallelFor(n, block_size, [&](size_t begin, size_t end) {
+    Histogram& c = counts[begin / block_size];
+    for (size_t i = begin; i < end; i++) {
+      uint64_t k = keys[i];
+      for (int d = 0; d < RADIX_PASSES; d++)
+        c[d * RADIX_BUCKETS + Digit(k, d)]++;
+    }
+  });
+
+  // skip digits shared by all keys, they cannot change the order
+  vector<int> digits;
+  for (int d = 0; d < RADIX_PASSES; d++) {
+    size_t same = 0;
+    for (size_t b = 0; b < num_blocks; b++)
+      same += counts[b][d * RADIX_BUCKETS + Digit(keys[0], d)];
+    if (same != n) digits.push_back(d);
+  }
+  if (digits.empty()) return true;
+
+  vector<uint64_t> keys_tmp(n);
+  vector<uint32_t> values_tmp(n);
+  vector<Histogram> offsets(num_blocks, Histogram(RADIX_BUCKETS));
+  for (size_t j = 0; j < digits.size(); j++) {
+    if (cancelled && cancelled()) return false;
+    int d = digits[j];
+    // totals per digit do not change, but what each block holds does
+    // after a scatter, so the block histograms have to be taken again
+    if (j > 0 && num_blocks > 1) {
+      pool.ParallelFor(n, block_size, [&](size_t begin, size_t end) {
+        Histogram& c = counts[begin / block_size];
+        fill(c.begin() + d * RADIX_BUCKETS, c.begin() + (d + 1) * RADIX_BUCKETS,
+             0);
+        for (size_t i = begin; i < end; i++)
+          c[d * RADIX_BUCKETS + Digit(keys[i], d)]++;
+      });
+    }
+
+    // blocks keep their relative order within a bucket, which is what
+    // makes the sort stable
+    size_t sum = 0;
+    for (int bucket = 0; bucket < RADIX_BUCKETS; bucket++) {
+      for (size_t b = 0; b < num_blocks; b++) {
+        offsets[b][bucket] = sum;
+        sum += counts[b][d * RADIX_BUCKETS + bucket];
+      }
+    }
+
+    pool.ParallelFor(n, block_size, [&](size_t begin, size_t end) {
+      // raw pointers, so the stores do not force reloads of the vectors
+      size_t* o = offsets[begin / block_size].data();
+      const uint64_t* k = keys.data();
+      const uint32_t* v = values.data();
+      uint64_t* k_out = keys_tmp.data();
+      uint32_t* v_out = values_tmp.data();
+      for (size_t i = begin; i < end; i++) {
+        size_t dst = o[Digit(k[i], d)]++;
+        k_out[dst] = k[i];
+        v_out[dst] = v[i];
+      }
+    });
+    keys.swap(keys_tmp);
+    values.swap(values_tmp);
+  }
+  return true;
+}
+
+void SortChunksByStart(ThreadPool& pool, const Chunk* chunks,
+                       uint32_t num_chunks, vector<uint32_t>& order) {
+  vector<uint64_t> keys(num_chunks);
+  order.resize(num_chunks);
+  pool.ParallelFor(num_chunks, RADIX_MIN_BLOCK, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      keys[i] = chunks[i].timestamp_start;
+      order[i] = i;
+    }
+  });
+  RadixSort(pool, keys, order);
+}
+
+}  // namespace memoro
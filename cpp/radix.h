@@ -0,0 +1,39 @@
+//===-- radix.h ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "memoro.h"
+#include "threadpool.h"
+
+namespace memoro {
+
+// stable LSD radix sort of 64 bit keys, 8 bits per pass. passes over
+// digits that are the same for every key (e.g. the high bytes of
+// timestamps) are skipped. sorts keys and carries values along.
+// cancelled is polled between passes, false if it stopped, with keys and
+// values in no particular order.
+bool RadixSort(ThreadPool& pool, std::vector<uint64_t>& keys,
+               std::vector<uint32_t>& values,
+               const CancelFn& cancelled = nullptr);
+
+// fill order with the permutation of chunks sorted by timestamp_start.
+// chunks are only read once, to gather the keys, so this works well
+// on the packed (unaligned) chunk mapping
+void SortChunksByStart(ThreadPool& pool, const Chunk* chunks,
+                       uint32_t num_chunks, std::vector<uint32_t>& order);
+
+}  // namespace memoro
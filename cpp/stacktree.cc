@@ -14,8 +14,11 @@
 
 #include "stacktree.h"
 #include <algorithm>
+#include <atomic>
 #include <iostream>
-#include <sstream>
+#include <memory>
+#include <mutex>
+#include "threadpool.h"
 
 namespace memoro {
 
@@ -23,233 +26,478 @@ using namespace std;
 using namespace v8;
 
 struct isolatedKeys {
+  const FrameTable* frames;
   Local<String> kName, kProcess, kValue;
   Local<String> kChildren;
   Local<String> kLifetime, kUsage, kUsefulLifetime;
+  Local<String> kId, kNumChildren;
+  Local<String> kOther, kOtherCount;
 };
 
-bool StackTreeNode::Insert(const TraceAndValue& tv, NameIDs::const_iterator pos,
-    const NameIDs& name_ids) {
-  // auto next = pos+1;
-  bool ret = false;
-  if (pos == name_ids.end()) {
-    // its the last one and will have no children
-    // e.g. this is a malloc/new call
-    trace_ = tv.trace;
-    value_ = tv.value;
-    ret = true;
-  } else {
-    value_ += tv.value;
-
-    auto it = find_if(children_.begin(), children_.end(),
-        [pos](const StackTreeNode& a) {
-        return a.name_ == pos->first && a.id_ == pos->second;
-        });
-
-    if (it != children_.end()) {
-      // exists, advance
-      ret = it->Insert(tv, pos + 1, name_ids);
-    } else {
-      // create new
-      children_.emplace_back(pos->second, pos->first, nullptr);
-      ret = children_.back().Insert(tv, pos + 1, name_ids);
-    }
-  }
-  return ret;
-}
+static isolatedKeys MakeKeys(Isolate* isolate, const FrameTable* frames) {
+  return {
+    frames,
+    String::NewFromUtf8(isolate, "name"),
+    String::NewFromUtf8(isolate, "process"),
+    String::NewFromUtf8(isolate, "value"),
+    String::NewFromUtf8(isolate, "children"),
 
-void StackTreeNode::Objectify(Isolate* isolate, Local<Object>& obj, const isolatedKeys& keys) const {
-  // put myself in this object
-  obj->Set(keys.kName,
-      String::NewFromUtf8(isolate, name_.c_str()));
-  obj->Set(keys.kValue,
-      Number::New(isolate, value_));
+    String::NewFromUtf8(isolate, "lifetime_score"),
+    String::NewFromUtf8(isolate, "usage_score"),
+    String::NewFromUtf8(isolate, "useful_lifetime_score"),
 
-  if (trace_ != nullptr) {
-    obj->Set(keys.kLifetime,
-        Number::New(isolate, trace_->lifetime_score));
-    obj->Set(keys.kUsage,
-        Number::New(isolate, trace_->usage_score));
-    obj->Set(keys.kUsefulLifetime,
-        Number::New(isolate, trace_->useful_lifetime_score));
-    return;
-  }
+    String::NewFromUtf8(isolate, "id"),
+    String::NewFromUtf8(isolate, "num_children"),
 
-  Local<Array> children = Array::New(isolate);
+    String::NewFromUtf8(isolate, "other"),
+    String::NewFromUtf8(isolate, "other_count"),
+  };
+}
 
-  for (size_t i = 0; i < children_.size(); i++) {
-    auto& child = children_[i];
-    Local<Object> child_obj = Object::New(isolate);
-    child.Objectify(isolate, child_obj, keys);
+// optional count argument, all if missing
+size_t CountArg(const FunctionCallbackInfo<Value>& args, int i) {
+  if (args.Length() <= i || !args[i]->IsNumber()) return SIZE_MAX;
+  double count = args[i]->NumberValue();
+  return count < 0 ? 0 : size_t(count);
+}
 
-    children->Set(i, child_obj);
-  }
+bool PageArgs(const FunctionCallbackInfo<Value>& args, int first,
+              size_t num_children, size_t& offset, size_t& end) {
+  offset = CountArg(args, first);
+  size_t count = CountArg(args, first + 1);
+  if (offset == SIZE_MAX) offset = 0;
+  if (offset >= num_children) return false;
+  end = offset + min(count, num_children - offset);
+  return true;
+}
 
-  obj->Set(keys.kChildren, children);
+// edge tables are kept at most half full
+#define EDGE_MIN_CAPACITY 1024ul
+#define EDGE_EMPTY UINT64_MAX
+// times larger than needed a table may be before Clear reallocates it
+#define EDGE_SHRINK 4
+
+static inline size_t EdgeHash(uint64_t key) {
+  // fibonacci hashing, the top bits of the product are well mixed
+  return (key * 0x9E3779B97F4A7C15ull) >> 32;
 }
 
-bool StackTreeNodeHide::Insert(const TraceAndValue& tv, NameIDs::const_iterator pos, const NameIDs& nameIds) {
-  if (children_.size() < MAX_TRACES) {
-    return StackTreeNode::Insert(tv, pos, nameIds);
+void EdgeMap::Clear(size_t expected) {
+  size_t capacity = EDGE_MIN_CAPACITY;
+  while (capacity < expected * 2) capacity *= 2;
+  // a table kept from a much larger use is given back, clearing it
+  // would cost its whole size every time
+  if (capacity > keys_.size() || keys_.size() > capacity * EDGE_SHRINK) {
+    vector<uint64_t>(capacity, EDGE_EMPTY).swap(keys_);
+    vector<uint32_t>(capacity).swap(children_);
   } else {
-    if (next_ == nullptr)
-      next_ = std::make_unique<StackTreeNodeHide>();
-
-    // Already taken care of by StackTreeNode::Insert() for if (true) { … }
-    value_ += tv.value;
+    fill(keys_.begin(), keys_.end(), EDGE_EMPTY);
+  }
+  size_ = 0;
+}
 
-    return next_->Insert(tv, pos, nameIds);
+uint32_t EdgeMap::Find(uint32_t parent, uint32_t frame) const {
+  uint64_t key = Key(parent, frame);
+  size_t mask = keys_.size() - 1;
+  for (size_t i = EdgeHash(key) & mask;; i = (i + 1) & mask) {
+    if (keys_[i] == key) return children_[i];
+    if (keys_[i] == EDGE_EMPTY) return NO_NODE;
   }
 }
 
-void StackTreeNodeHide::Objectify(Isolate* isolate, Local<Object>& obj, const isolatedKeys& keys) const {
-  // put myself in this object
-  obj->Set(keys.kName,
-      String::NewFromUtf8(isolate, name_.c_str()));
-  obj->Set(keys.kValue,
-      Number::New(isolate, value_));
+void EdgeMap::Insert(uint32_t parent, uint32_t frame, uint32_t child) {
+  if ((size_ + 1) * 2 > keys_.size()) Grow();
+  uint64_t key = Key(parent, frame);
+  size_t mask = keys_.size() - 1;
+  size_t i = EdgeHash(key) & mask;
+  while (keys_[i] != EDGE_EMPTY) i = (i + 1) & mask;
+  keys_[i] = key;
+  children_[i] = child;
+  size_++;
+}
 
-  if (next_) {
-    Local<Array> children = Array::New(isolate);
+void EdgeMap::Grow() {
+  vector<uint64_t> keys(max(keys_.size() * 2, EDGE_MIN_CAPACITY), EDGE_EMPTY);
+  vector<uint32_t> children(keys.size());
+  size_t mask = keys.size() - 1;
+  for (size_t j = 0; j < keys_.size(); j++) {
+    if (keys_[j] == EDGE_EMPTY) continue;
+    size_t i = EdgeHash(keys_[j]) & mask;
+    while (keys[i] != EDGE_EMPTY) i = (i + 1) & mask;
+    keys[i] = keys_[j];
+    children[i] = children_[j];
+  }
+  keys_.swap(keys);
+  children_.swap(children);
+}
 
-    Local<Object> next_obj = Object::New(isolate);
-    next_->Objectify(isolate, next_obj, keys);
-    children->Set(0, next_obj);
+namespace {
+
+// nodes are first created in insertion order with explicit links, then
+// laid out in preorder
+struct BuildNode {
+  uint32_t frame;
+  uint32_t parent;
+  uint32_t first_child = NO_NODE;
+  uint32_t last_child = NO_NODE;
+  uint32_t next_sibling = NO_NODE;
+  const Trace* trace = nullptr;
+};
 
-    obj->Set(keys.kChildren, children);
-  }
+// the child of node for frame, created after the existing children if it
+// is new
+uint32_t BuildChild(vector<BuildNode>& nodes, EdgeMap& edges, uint32_t node,
+                    uint32_t frame) {
+  uint32_t child = edges.Find(node, frame);
+  if (child != NO_NODE) return child;
+  child = nodes.size();
+  edges.Insert(node, frame, child);
+  nodes.push_back(BuildNode());
+  nodes.back().frame = frame;
+  nodes.back().parent = node;
+  BuildNode& p = nodes[node];
+  if (p.last_child == NO_NODE)
+    p.first_child = child;
+  else
+    nodes[p.last_child].next_sibling = child;
+  p.last_child = child;
+  return child;
 }
 
-bool StackTree::InsertTrace(const TraceAndValue& tv) {
-  // assuming stacktrace of form
-  // #1 0x10be26858 in main test.cpp:57
-
-  const string& trace = tv.trace->trace;
-  NameIDs name_ids;
-  stringstream ss;
-  string name;
-  uint64_t addr = 0;
-
-  auto position = find(trace.rbegin(), trace.rend(), '#');
-
-  // this is done once, so we are fine with all this
-  // C++-y nonsense that allocates stuff :-P
-  // #27 0x118b1a035  (<unknown module>)|
-  while (position != trace.rend()) {
-    ss.clear();
-    size_t pos = trace.rend() - position;  // backward :-P
-    size_t p1 = trace.find_first_of(' ', pos);
-    size_t p2 = trace.find_first_of(' ', p1 + 1);
-    ss << std::hex << trace.substr(p1 + 1, p2 - p1);
-    ss >> addr;
-    if (trace[p2 + 2] == '(')
-      name = "unknown";  // unknown module
-    else {
-      p1 = trace.find_first_of(' ', p2 + 1);
-      p2 = trace.find_first_of('|', p1 + 1);
-      name = trace.substr(p1 + 1, p2 - p1 - 1);
+// preorder position of every node given the size of every subtree.
+// children are created after their parent, so one forward pass
+void Layout(const vector<BuildNode>& nodes, const vector<uint32_t>& size,
+            vector<uint32_t>& position) {
+  position.resize(nodes.size());
+  position[0] = 0;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    uint32_t next = position[i] + 1;
+    for (uint32_t c = nodes[i].first_child; c != NO_NODE;
+         c = nodes[c].next_sibling) {
+      position[c] = next;
+      next += size[c];
     }
+  }
+}
 
-    name_ids.push_back(make_pair(name, addr));
+}  // namespace
 
-    position = find(position + 1, trace.rend(), '#');
+// a subtree below the second level, built on its own
+struct StackTree::Group {
+  uint32_t top;  // its root, a second level node
+  vector<uint32_t> traces;
+  // in preorder, [0] is the root. parents and ends relative to it
+  vector<StackTreeNode> nodes;
+  vector<uint32_t> trace_nodes;
+};
+
+void StackTree::BuildTopology() {
+  // the first two levels serially, in trace order. everything below a
+  // second level node only depends on the traces through it, so those
+  // subtrees are built in parallel and copied into place. the result is
+  // the same as inserting all traces in order
+  vector<BuildNode> top(1);
+  top[0].frame = 0;
+  top[0].parent = NO_NODE;
+  edges_.Clear(traces_.size());
+  trace_nodes_.assign(traces_.size(), NO_NODE);
+  vector<uint32_t> group_of(traces_.size(), NO_NODE);
+  vector<uint32_t> top_group;  // per top node
+  vector<Group> groups;
+  for (size_t i = 0; i < traces_.size(); i++) {
+    // the trace was parsed into frame ids at load, from `main' to malloc,
+    // so to speak
+    const FramePath& path = traces_[i].trace->frames;
+    if (path.empty()) continue;
+    uint32_t node = 0;
+    for (size_t d = 0; d < path.size() && d < 2; d++)
+      node = BuildChild(top, edges_, node, path[d]);
+    if (path.size() <= 2) {
+      if (top[node].trace == nullptr) top[node].trace = traces_[i].trace;
+      trace_nodes_[i] = node;
+      continue;
+    }
+    if (top_group.size() < top.size()) top_group.resize(top.size(), NO_NODE);
+    if (top_group[node] == NO_NODE) {
+      top_group[node] = groups.size();
+      groups.push_back(Group());
+      groups.back().top = node;
+    }
+    groups[top_group[node]].traces.push_back(i);
+  }
+  top_group.resize(top.size(), NO_NODE);
+
+  // edge tables grow to the largest group they saw, they are reused
+  // between groups and freed once the tree is built
+  auto pool = WorkerPool();
+  mutex edges_mu;
+  vector<unique_ptr<EdgeMap>> idle_edges;
+  pool->ParallelFor(groups.size(), 1, [&](size_t begin, size_t end) {
+    unique_ptr<EdgeMap> edges;
+    {
+      lock_guard<mutex> lock(edges_mu);
+      if (!idle_edges.empty()) {
+        edges = move(idle_edges.back());
+        idle_edges.pop_back();
+      }
+    }
+    if (!edges) edges.reset(new EdgeMap());
+    for (size_t g = begin; g < end; g++) BuildGroup(groups[g], *edges);
+    lock_guard<mutex> lock(edges_mu);
+    idle_edges.push_back(move(edges));
+  });
+
+  // lay out the top levels with room for the groups, then copy them in
+  vector<uint32_t> size(top.size(), 1);
+  for (size_t i = top.size() - 1; i > 0; i--) {
+    if (top_group[i] != NO_NODE) size[i] = groups[top_group[i]].nodes.size();
+    size[top[i].parent] += size[i];
   }
+  vector<uint32_t> position;
+  Layout(top, size, position);
+
+  nodes_.resize(size[0]);
+  for (size_t i = 0; i < top.size(); i++) {
+    StackTreeNode& n = nodes_[position[i]];
+    n.frame = top[i].frame;
+    n.parent = i == 0 ? NO_NODE : position[top[i].parent];
+    n.end = position[i] + size[i];
+    n.trace = top[i].trace;
+  }
+  for (auto& node : trace_nodes_)
+    if (node != NO_NODE) node = position[node];
+  pool->ParallelFor(groups.size(), 16, [&](size_t begin, size_t end) {
+    for (size_t g = begin; g < end; g++) {
+      Group& group = groups[g];
+      uint32_t base = position[group.top];
+      for (size_t j = 1; j < group.nodes.size(); j++) {
+        StackTreeNode n = group.nodes[j];
+        n.parent += base;
+        n.end += base;
+        nodes_[base + j] = n;
+      }
+      for (size_t k = 0; k < group.traces.size(); k++)
+        trace_nodes_[group.traces[k]] = base + group.trace_nodes[k];
+    }
+  });
 
-  value_ += tv.value;
+  roots_.clear();
+  for (uint32_t c = 1; c < nodes_.size(); c = nodes_[c].end) roots_.push_back(c);
+}
 
-  // Cap the number of node at MAX_TRACES and hide the rest
-  if (node_count_++ >= MAX_TRACES) {
-    if (hide_ == nullptr)
-      hide_ = std::make_unique<StackTreeNodeHide>();
+void StackTree::BuildGroup(Group& group, EdgeMap& edges) {
+  vector<BuildNode> tmp(1);
+  tmp[0].frame = 0;
+  tmp[0].parent = NO_NODE;
+  edges.Clear(group.traces.size());
+  group.trace_nodes.resize(group.traces.size());
+  for (size_t k = 0; k < group.traces.size(); k++) {
+    const Trace* trace = traces_[group.traces[k]].trace;
+    const FramePath& path = trace->frames;
+    uint32_t node = 0;
+    for (size_t d = 2; d < path.size(); d++)
+      node = BuildChild(tmp, edges, node, path[d]);
+    if (tmp[node].trace == nullptr) tmp[node].trace = trace;
+    group.trace_nodes[k] = node;
+  }
 
-    return hide_->Insert(tv, name_ids.begin() + 1, name_ids);
+  vector<uint32_t> size(tmp.size(), 1);
+  for (size_t i = tmp.size() - 1; i > 0; i--) size[tmp[i].parent] += size[i];
+  vector<uint32_t> position;
+  Layout(tmp, size, position);
+  group.nodes.resize(tmp.size());
+  for (size_t i = 1; i < tmp.size(); i++) {
+    StackTreeNode& n = group.nodes[position[i]];
+    n.frame = tmp[i].frame;
+    n.parent = position[tmp[i].parent];
+    n.end = position[i] + size[i];
+    n.trace = tmp[i].trace;
   }
+  for (auto& node : group.trace_nodes) node = position[node];
+}
 
-  // now we have a list of function name, ID (address) pairs from
-  // `main' to malloc, so to speak ... insert into the stack tree
-  auto& first = name_ids[0];
-  auto it =
-      find_if(roots_.begin(), roots_.end(), [first](const StackTreeNode& a) {
-        return a.name_ == first.first && a.id_ == first.second;
-      });
+void StackTree::SumValues(vector<double>& values) const {
+  // root subtrees are contiguous and independent of each other
+  auto pool = WorkerPool();
+  pool->ParallelFor(roots_.size(), 1, [this, &values](size_t begin, size_t end) {
+    for (size_t r = begin; r < end; r++) {
+      uint32_t root = roots_[r];
+      for (uint32_t i = nodes_[root].end - 1; i > root; i--) {
+        values[nodes_[i].parent] += values[i];
+      }
+    }
+  });
+}
+
+void StackTree::TopChildren(uint32_t node, vector<uint32_t>& top,
+                            Other& other) const {
+  top.clear();
+  other = Other();
+  if (values_.empty()) return;
+  for (uint32_t c = node + 1; c < nodes_[node].end; c = nodes_[c].end)
+    if (values_[c] != 0) top.push_back(c);
+
+  // largest first, ties to the earlier node so the split is stable
+  auto larger = [this](uint32_t a, uint32_t b) {
+    return values_[a] > values_[b] || (values_[a] == values_[b] && a < b);
+  };
+  SelectTopK(top, top_k_, larger, [this, &other](uint32_t c) {
+    other.value += values_[c];
+    other.count++;
+  });
+}
+
+Local<Object> StackTree::ObjectifyOther(Isolate* isolate, const Other& other,
+                                        const isolatedKeys& keys) const {
+  // stands for several nodes, so it has no id and cannot be expanded
+  Local<Object> obj = Object::New(isolate);
+  obj->Set(keys.kId, Number::New(isolate, -1));
+  obj->Set(keys.kName, keys.kOther);
+  obj->Set(keys.kValue, Number::New(isolate, other.value));
+  obj->Set(keys.kNumChildren, Number::New(isolate, 0));
+  obj->Set(keys.kOtherCount, Number::New(isolate, other.count));
+  return obj;
+}
 
-  if (it != roots_.end()) {
-    // exists, proceed with insert
-    return (*it).Insert(tv, name_ids.begin() + 1, name_ids);
+Local<Object> StackTree::Objectify(Isolate* isolate, uint32_t node,
+                                   const isolatedKeys& keys, size_t count,
+                                   size_t depth) const {
+  const StackTreeNode& n = nodes_[node];
+  Local<Object> obj = Object::New(isolate);
+  // put myself in this object
+  obj->Set(keys.kId, Number::New(isolate, node));
+  if (node == 0) {
+    obj->Set(keys.kName, keys.kProcess);
+    obj->Set(keys.kValue, Number::New(isolate, value_));
   } else {
-    // create new root (recall these are entry points, e.g. main,
-    // pthread_create, etc. )
-    roots_.emplace_back(name_ids[0].second, name_ids[0].first, nullptr);
-    return roots_.back().Insert(tv, name_ids.begin() + 1, name_ids);
+    obj->Set(keys.kName,
+        String::NewFromUtf8(isolate, keys.frames->Get(n.frame).name.c_str()));
+    obj->Set(keys.kValue,
+        Number::New(isolate, values_[node]));
   }
-}
 
-void StackTree::BuildTree() {
-  value_ = 0;
-  node_count_ = 0;
-  roots_.clear();
-  hide_.reset(nullptr);
-  for (auto it = traces_.cbegin(); it != traces_.cend(); it++)
-    InsertTrace(*it);
+  if (n.trace != nullptr) {
+    obj->Set(keys.kNumChildren, Number::New(isolate, 0));
+    obj->Set(keys.kLifetime,
+        Number::New(isolate, n.trace->lifetime_score));
+    obj->Set(keys.kUsage,
+        Number::New(isolate, n.trace->usage_score));
+    obj->Set(keys.kUsefulLifetime,
+        Number::New(isolate, n.trace->useful_lifetime_score));
+    return obj;
+  }
+
+  vector<uint32_t> top;
+  Other other;
+  TopChildren(node, top, other);
+  size_t num_children = top.size() + (other.count > 0);
+  obj->Set(keys.kNumChildren, Number::New(isolate, num_children));
+  // children left out are fetched with stacktree_children
+  if (depth == 0) return obj;
+
+  auto children = ChildrenArray(
+      isolate, 0, min(count, num_children), [&](size_t i) {
+        if (i < top.size())
+          return Objectify(isolate, top[i], keys, count, depth - 1);
+        return ObjectifyOther(isolate, other, keys);
+      });
+  obj->Set(keys.kChildren, children);
+  return obj;
 }
 
-void StackTree::SetTraces(std::vector<Trace>& traces) {
+void StackTree::SetTraces(std::vector<Trace>& traces,
+                          const FrameTable& frames) {
+  frames_ = &frames;
   traces_.clear();
   traces_.reserve(traces.size());
   for (Trace& t: traces)
     traces_.push_back({ &t, 0.0 });
+  BuildTopology();
+  values_.clear();
+  value_ = 0;
 }
 
-void StackTree::V8Objectify(const v8::FunctionCallbackInfo<v8::Value>& args) {
+void StackTree::V8Objectify(const v8::FunctionCallbackInfo<v8::Value>& args,
+                            int first) {
   Isolate* isolate = args.GetIsolate();
-  const isolatedKeys keys = {
-    String::NewFromUtf8(isolate, "name"),
-    String::NewFromUtf8(isolate, "process"),
-    String::NewFromUtf8(isolate, "value"),
-    String::NewFromUtf8(isolate, "children"),
-
-    String::NewFromUtf8(isolate, "lifetime_score"),
-    String::NewFromUtf8(isolate, "usage_score"),
-    String::NewFromUtf8(isolate, "useful_lifetime_score"),
-  };
-
-  Local<Object> root = Object::New(isolate);
-  root->Set(keys.kName, keys.kProcess);
-  root->Set(keys.kValue, Number::New(isolate, value_));
-
-  Local<Array> children = Array::New(isolate);
-
-  for (size_t i = 0; i < roots_.size(); i++) {
-    const auto& root = roots_[i];
-    Local<Object> child_obj = Object::New(isolate);
-
-    root.Objectify(isolate, child_obj, keys);  // recursively
-
-    children->Set(i, child_obj);
+  const isolatedKeys keys = MakeKeys(isolate, frames_);
+
+  // at most count children per node and depth levels below the root,
+  // the whole tree without arguments
+  size_t count = CountArg(args, first);
+  size_t depth = CountArg(args, first + 1);
+  if (nodes_.empty()) {
+    Local<Object> root = Object::New(isolate);
+    root->Set(keys.kName, keys.kProcess);
+    root->Set(keys.kValue, Number::New(isolate, 0));
+    root->Set(keys.kChildren, Array::New(isolate));
+    args.GetReturnValue().Set(root);
+    return;
   }
+  args.GetReturnValue().Set(Objectify(isolate, 0, keys, count, depth));
+}
 
-  if (hide_) {
-    Local<Object> hide_obj = Object::New(isolate);
-
-    hide_->Objectify(isolate, hide_obj, keys);  // recursively
+void StackTree::V8Children(const v8::FunctionCallbackInfo<v8::Value>& args,
+                           int first) {
+  Isolate* isolate = args.GetIsolate();
+  const isolatedKeys keys = MakeKeys(isolate, frames_);
+  args.GetReturnValue().Set(Array::New(isolate));
 
-    children->Set(roots_.size(), hide_obj);
+  double id = args[first]->NumberValue();
+  if (!(id >= 0 && id < nodes_.size())) {
+    cout << "STACKTREE NODE OUT OF RANGE\n";
+    return;
   }
-
-  root->Set(keys.kChildren, children);
-
-  args.GetReturnValue().Set(root);
+  uint32_t node = id;
+  if (nodes_[node].trace != nullptr) return;
+
+  vector<uint32_t> top;
+  Other other;
+  TopChildren(node, top, other);
+  size_t offset, end;
+  if (!PageArgs(args, first + 1, top.size() + (other.count > 0), offset, end))
+    return;
+  args.GetReturnValue().Set(
+      ChildrenArray(isolate, offset, end, [&](size_t i) {
+        if (i < top.size()) return Objectify(isolate, top[i], keys, 0, 0);
+        return ObjectifyOther(isolate, other, keys);
+      }));
 }
 
-void StackTree::Aggregate(const std::function<double(const Trace* t)>& f) {
-  for (auto& tv: traces_)
-    tv.value = f(tv.trace);
+bool StackTree::Aggregate(const std::function<double(const Trace* t)>& f,
+                          const CancelFn& cancelled) {
+  auto pool = WorkerPool();
+  atomic<bool> stopped(false);
+  pool->ParallelFor(traces_.size(), 1024,
+                    [this, &f, &cancelled, &stopped](size_t begin, size_t end) {
+    if (stopped || (cancelled && cancelled())) {
+      stopped = true;
+      return;
+    }
+    for (size_t i = begin; i < end; i++) traces_[i].value = f(traces_[i].trace);
+  });
+  if (stopped) return false;
+
+  // leaf values, then summed up, aside so a cancelled call leaves the
+  // values as they were. the topology stays as it is
+  double value = 0;
+  vector<double> values(nodes_.size(), 0);
+  for (size_t i = 0; i < traces_.size(); i++) {
+    value += traces_[i].value;
+    if (trace_nodes_[i] != NO_NODE) values[trace_nodes_[i]] += traces_[i].value;
+  }
+  if (cancelled && cancelled()) return false;
+  SumValues(values);
+  value_ = value;
+  values_.swap(values);
+  return true;
+}
 
-  sort(traces_.begin(), traces_.end(),
-      [](const TraceAndValue& a, const TraceAndValue& b) {
-        return a.value > b.value; });
+void StackTree::SetTopK(size_t k) { top_k_ = k == 0 ? 1 : k; }
 
-  BuildTree();
+size_t StackTree::Bytes() const {
+  return VectorBytes(nodes_) + VectorBytes(trace_nodes_) + VectorBytes(roots_) +
+         VectorBytes(values_) + VectorBytes(traces_) + edges_.Bytes();
 }
 
 }  // namespace memoro
@@ -15,15 +15,22 @@
 #pragma once
 
 #include <v8.h>
+#include <algorithm>
 #include <functional>
 //#include <tuple>
+#include "frames.h"
 #include "memoro.h"
 
 namespace memoro {
 
-#define MAX_TRACES 1000ul
+// children shown per node unless set from JS, the rest are summed up
+// in one "other" node
+#define STACKTREE_TOP_K 100ul
 
-using NameIDs = std::vector<std::pair<std::string, uint64_t>>;
+// no node, for the links between nodes
+#define NO_NODE UINT32_MAX
+
+using FramePath = std::vector<uint32_t>;
 
 struct isolatedKeys;
 
@@ -32,60 +39,148 @@ struct TraceAndValue {
   double value;
 };
 
-class StackTreeNode {
- public:
-  StackTreeNode(uint64_t id, std::string name, const Trace* trace)
-      : id_(id), name_(name), trace_(trace) {}
-
-  bool Insert(const TraceAndValue&, NameIDs::const_iterator, const NameIDs&);
-  void Objectify(v8::Isolate*, v8::Local<v8::Object>&, const isolatedKeys&) const;
-
- protected:
-  friend class StackTree;
-  uint64_t id_;
-  std::string name_;  // string_view would be better
-
-  // if trace is not nullptr, there can be no children
-  const Trace* trace_ = nullptr;
-  std::vector<StackTreeNode> children_;
-  double value_ = 0;
+// nodes are stored in depth first preorder, so the subtree of node i is
+// the range [i, end) and its first child, if any, is i + 1. the next
+// sibling of a child c is nodes_[c].end
+struct StackTreeNode {
+  uint32_t frame;  // id in the FrameTable
+  uint32_t parent;
+  uint32_t end;
+  // a trace ends at this node, no children are shown then
+  const Trace* trace = nullptr;
 };
 
-class StackTreeNodeHide : public StackTreeNode {
-  public:
-    StackTreeNodeHide() : StackTreeNode(-1, "Hide", nullptr) {};
-
-    bool Insert(const TraceAndValue&, NameIDs::const_iterator, const NameIDs&);
-    void Objectify(v8::Isolate*, v8::Local<v8::Object>&, const isolatedKeys&) const;
+// map from (parent node, frame) to the child node, open addressing so
+// lookups are a hash and mostly one probe. cleared, not freed, between
+// uses, unless it is much larger than the next use needs
+class EdgeMap {
+ public:
+  void Clear(size_t expected);
+  // the child, or NO_NODE
+  uint32_t Find(uint32_t parent, uint32_t frame) const;
+  void Insert(uint32_t parent, uint32_t frame, uint32_t child);
+  size_t Bytes() const { return VectorBytes(keys_) + VectorBytes(children_); }
 
-  private:
-    std::unique_ptr<StackTreeNodeHide> next_ = nullptr;
+ private:
+  static uint64_t Key(uint32_t parent, uint32_t frame) {
+    return (uint64_t(parent) << 32) | frame;
+  }
+  void Grow();
+
+  std::vector<uint64_t> keys_;
+  std::vector<uint32_t> children_;
+  size_t size_ = 0;
 };
 
+// helpers of the JS trees, shared with the diff tree (see diff.h)
+
+// optional count argument args[i], SIZE_MAX if it is missing
+size_t CountArg(const v8::FunctionCallbackInfo<v8::Value>& args, int i);
+
+// keep the k nodes that are first by larger, in order, and call
+// rest(node) for the others, which are rolled up into "other"
+template <typename Larger, typename Rest>
+void SelectTopK(std::vector<uint32_t>& nodes, size_t k, Larger larger,
+                Rest rest) {
+  if (nodes.size() > k) {
+    std::nth_element(nodes.begin(), nodes.begin() + k, nodes.end(), larger);
+    for (size_t i = k; i < nodes.size(); i++) rest(nodes[i]);
+    nodes.resize(k);
+  }
+  std::sort(nodes.begin(), nodes.end(), larger);
+}
+
+// the page [offset, end) of num_children children asked for by args
+// (offset, count) from args[first] on. false if it is empty
+bool PageArgs(const v8::FunctionCallbackInfo<v8::Value>& args, int first,
+              size_t num_children, size_t& offset, size_t& end);
+
+// children [offset, end) as a JS array, child(i) makes child i
+template <typename Child>
+v8::Local<v8::Array> ChildrenArray(v8::Isolate* isolate, size_t offset,
+                                   size_t end, Child child) {
+  v8::Local<v8::Array> children = v8::Array::New(isolate);
+  for (size_t i = offset; i < end; i++) children->Set(i - offset, child(i));
+  return children;
+}
+
+// Call tree of all traces, weighted by a per trace metric.
+//
+// the topology only depends on the traces, so it is built once when they
+// are set, the subtrees below the first two levels on the worker pool.
+// Aggregate then computes the metric for every trace and sums
+// the values up the tree, one pass per root subtree on the worker pool.
+// it can be cancelled, the values only change once it is done.
+// when the tree is sent to JS every node shows its top K children by
+// value, picked by selection, and rolls the rest up into an "other" node
+// with their exact total. children with a value of 0 are left out.
 class StackTree {
  public:
-  void SetTraces(std::vector<Trace>&);
-  void Aggregate(const std::function<double(const Trace* t)>& f);
+  // the frames are the table the traces' frame paths point into
+  void SetTraces(std::vector<Trace>&, const FrameTable& frames);
+  // false if cancelled, the tree keeps its values
+  bool Aggregate(const std::function<double(const Trace* t)>& f,
+                 const CancelFn& cancelled = nullptr);
 
   // set args return value to object heirarchy representing tree
-  // suitable for the calling JS process
-  void V8Objectify(const v8::FunctionCallbackInfo<v8::Value>& args);
+  // suitable for the calling JS process. optional args (count, depth)
+  // limit it to the largest count children of each node and depth levels
+  // below the root. every node has its id and num_children, so what was
+  // left out can be fetched with V8Children. the arguments start at
+  // args[first], for both
+  void V8Objectify(const v8::FunctionCallbackInfo<v8::Value>& args,
+                   int first = 0);
+
+  // args (id, offset, count): set args return value to the array of
+  // children [offset, offset + count) of node id, largest first, without
+  // their own children. ids stay valid for the dataset, across metrics
+  void V8Children(const v8::FunctionCallbackInfo<v8::Value>& args,
+                  int first = 0);
+
+  // children shown per node before the rest go to "other", at least 1
+  void SetTopK(size_t k);
+
+  size_t Bytes() const;
 
   // For other datatype conversions, add an objectify function here
-  // and a recursive helper in StackTreeNode
+  // and a recursive helper
 
  private:
-  bool InsertTrace(const TraceAndValue& tv);
-  void BuildTree();
-
-  // multiple roots are possible because
-  // not all traces start in ``main'' for example,
-  // some may start in pthread_create() or equivalent
-  std::unique_ptr<StackTreeNodeHide> hide_;
-  std::vector<StackTreeNode> roots_;
+  struct Group;
+  void BuildTopology();
+  void BuildGroup(Group& group, EdgeMap& edges);
+  void SumValues(std::vector<double>& values) const;
+  // the rest of the children of a node past the top K
+  struct Other {
+    double value = 0;
+    size_t count = 0;
+  };
+  // the top K children of node with a value, largest first
+  void TopChildren(uint32_t node, std::vector<uint32_t>& top,
+                   Other& other) const;
+  v8::Local<v8::Object> Objectify(v8::Isolate*, uint32_t node,
+                                  const isolatedKeys&, size_t count,
+                                  size_t depth) const;
+  v8::Local<v8::Object> ObjectifyOther(v8::Isolate*, const Other& other,
+                                       const isolatedKeys&) const;
+
+  // node 0 is the root of the tree, its children are the entry points.
+  // multiple are possible because not all traces start in ``main'' for
+  // example, some may start in pthread_create() or equivalent
+  std::vector<StackTreeNode> nodes_;
+  // node each trace ends at, NO_NODE for traces without frames
+  std::vector<uint32_t> trace_nodes_;
+  // children of node 0, for the parallel sums
+  std::vector<uint32_t> roots_;
+
+  // for the current metric, the sum over the traces below each node
+  std::vector<double> values_;
+  double value_ = 0;  // the sum total of all trace values
+
   std::vector<TraceAndValue> traces_;
-  double value_ = 0;  // the sum total of all root aggregate values
-  size_t node_count_ = 0;
+  const FrameTable* frames_ = nullptr;
+  EdgeMap edges_;
+  size_t top_k_ = STACKTREE_TOP_K;
 };
 
 }  // namespace memoro
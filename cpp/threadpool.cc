@@ -0,0 +1,126 @@
+//===-- threadpool.cc ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#include "threadpool.h"
+#include <atomic>
+
+namespace memoro {
+
+using namespace std;
+
+ThreadPool::ThreadPool(unsigned num_threads) {
+  if (num_threads == 0) num_threads = 1;
+  for (unsigned i = 1; i < num_threads; i++)
+    threads_.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> l(mu_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& t : threads_) t.join();
+}
+
+void ThreadPool::WorkerLoop() {
+  while (true) {
+    function<void()> task;
+    {
+      unique_lock<mutex> l(mu_);
+      cv_.wait(l, [this]() { return stop_ || !queue_.empty(); });
+      if (stop_ && queue_.empty()) return;
+      task = move(queue_.front());
+      queue_.pop_front();
+    }
+    task();
+  }
+}
+
+namespace {
+
+struct ForState {
+  size_t n;
+  size_t grain;
+  size_t num_blocks;
+  const function<void(size_t, size_t)>* fn;
+  atomic<size_t> next{0};
+  atomic<size_t> done{0};
+  mutex mu;
+  condition_variable cv;
+
+  // grab blocks until there are none left
+  void Run() {
+    size_t block;
+    while ((block = next.fetch_add(1)) < num_blocks) {
+      size_t begin = block * grain;
+      (*fn)(begin, min(begin + grain, n));
+      if (done.fetch_add(1) + 1 == num_blocks) {
+        lock_guard<mutex> l(mu);
+        cv.notify_all();
+      }
+    }
+  }
+};
+
+}  // namespace
+
+void ThreadPool::ParallelFor(size_t n, size_t grain,
+                             const function<void(size_t, size_t)>& fn) {
+  if (n == 0) return;
+  if (grain == 0) grain = 1;
+  size_t num_blocks = (n + grain - 1) / grain;
+  if (num_blocks == 1 || threads_.empty()) {
+    fn(0, n);
+    return;
+  }
+
+  auto state = make_shared<ForState>();
+  state->n = n;
+  state->grain = grain;
+  state->num_blocks = num_blocks;
+  state->fn = &fn;
+
+  // helpers that start after all blocks are taken return right away,
+  // so fn is never touched after we return
+  size_t helpers = min(num_blocks - 1, threads_.size());
+  {
+    lock_guard<mutex> l(mu_);
+    for (size_t i = 0; i < helpers; i++)
+      queue_.emplace_back([state]() { state->Run(); });
+  }
+  cv_.notify_all();
+
+  state->Run();
+  unique_lock<mutex> l(state->mu);
+  state->cv.wait(l, [&state]() { return state->done == state->num_blocks; });
+}
+
+static mutex pool_mu;
+static shared_ptr<ThreadPool> pool;
+
+shared_ptr<ThreadPool> WorkerPool() {
+  lock_guard<mutex> l(pool_mu);
+  if (!pool) pool = make_shared<ThreadPool>(thread::hardware_concurrency());
+  return pool;
+}
+
+void SetNumWorkers(unsigned num_workers) {
+  if (num_workers == 0) num_workers = thread::hardware_concurrency();
+  lock_guard<mutex> l(pool_mu);
+  if (pool && pool->NumThreads() == num_workers) return;
+  pool = make_shared<ThreadPool>(num_workers);
+}
+
+}  // namespace memoro
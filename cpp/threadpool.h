@@ -0,0 +1,96 @@
+//===-- threadpool.h ------------------------------------------------===//
+//
+//                     Memoro
+//
+// This file is distributed under the MIT License.
+// See LICENSE for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of Memoro.
+// Stuart Byma, EPFL.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "memoro.h"
+
+namespace memoro {
+
+// fixed set of worker threads used to split up the heavy data processing
+// (dataset load, aggregation, ...). ParallelFor can be called from any
+// thread, including from inside another ParallelFor, because the calling
+// thread always works on its own loop as well.
+class ThreadPool {
+ public:
+  // num_threads includes the calling thread, so 1 means run everything inline
+  explicit ThreadPool(unsigned num_threads);
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  ~ThreadPool();
+
+  unsigned NumThreads() const { return threads_.size() + 1; }
+
+  // call fn(begin, end) over [0, n) in blocks of at most grain items,
+  // returns once all blocks are done
+  void ParallelFor(size_t n, size_t grain,
+                   const std::function<void(size_t, size_t)>& fn);
+
+ private:
+  void WorkerLoop();
+
+  std::vector<std::thread> threads_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> queue_;
+  bool stop_ = false;
+};
+
+// the pool shared by all of memoro. hold on to the returned pointer for the
+// duration of an operation, SetNumWorkers may replace the pool at any time
+std::shared_ptr<ThreadPool> WorkerPool();
+
+// sort [first, last) by sorting one block per thread and merging the
+// sorted blocks pairwise, also in parallel
+template <typename T, typename Compare>
+void ParallelSort(ThreadPool& pool, std::vector<T>& v, Compare comp) {
+  size_t n = v.size();
+  size_t blocks = pool.NumThreads();
+  if (blocks <= 1 || n < blocks * 4096) {
+    std::sort(v.begin(), v.end(), comp);
+    return;
+  }
+  size_t block_size = (n + blocks - 1) / blocks;
+  pool.ParallelFor(n, block_size, [&v, &comp](size_t begin, size_t end) {
+    std::sort(v.begin() + begin, v.begin() + end, comp);
+  });
+
+  std::vector<T> buf(n);
+  std::vector<T>* src = &v;
+  std::vector<T>* dst = &buf;
+  for (size_t width = block_size; width < n; width *= 2) {
+    size_t pairs = (n + 2 * width - 1) / (2 * width);
+    pool.ParallelFor(pairs, 1, [=, &comp](size_t begin, size_t end) {
+      for (size_t p = begin; p < end; p++) {
+        size_t lo = p * 2 * width;
+        size_t mid = std::min(lo + width, n);
+        size_t hi = std::min(lo + 2 * width, n);
+        std::merge(src->begin() + lo, src->begin() + mid, src->begin() + mid,
+                   src->begin() + hi, dst->begin() + lo, comp);
+      }
+    });
+    std::swap(src, dst);
+  }
+  if (src != &v) v.swap(buf);
+}
+
+}  // namespace memoro
@@ -33,6 +33,13 @@ var gmean = require('compute-gmean');
 
 const settings = require('electron').remote.require('electron-settings');
 
+// number of native worker threads used to load and process datasets,
+// 0 (the default) uses one per hardware thread
+if (settings.has('workers'))
+    memoro.set_num_workers(settings.get('workers'));
+if (settings.has('memory_budget'))
+    memoro.set_memory_budget(settings.get('memory_budget'));
+
 function bytesToString(bytes,decimals) {
     if(bytes == 0) return '0 B';
     var k = 1024,
@@ -56,6 +63,27 @@ var bytesToStringNoDecimal = function (bytes) {
     }
 }
 
+function traceText(trace_index) {
+    if (!(trace_index in trace_texts))
+        trace_texts[trace_index] = memoro.trace_text(dataset_id, trace_index);
+    return trace_texts[trace_index];
+}
+
+// the fields of trace i of a memoro.traces() page
+function traceRow(traces, i) {
+    return {
+        trace_index: traces.trace_index[i],
+        type: type_names[traces.type_id[i]],
+        num_chunks: traces.num_chunks[i],
+        chunk_index: traces.chunk_index[i],
+        max_aggregate: traces.max_aggregate[i],
+        alloc_time_total: traces.alloc_time_total[i],
+        usage_score: traces.usage_score[i],
+        lifetime_score: traces.lifetime_score[i],
+        useful_lifetime_score: traces.useful_lifetime_score[i]
+    };
+}
+
 // convenience globals
 var barHeight;
 var total_chunks;
@@ -71,6 +99,14 @@ var max_x;
 var num_traces;
 var current_fg_type = "num_allocs";
 var current_fg_time = 0;
+// the flame graph shows the largest FG_CHILDREN children of each node,
+// the rest are summed up in an "other" node. the tree is loaded FG_DEPTH
+// levels deep, deeper nodes are loaded when clicked
+var FG_CHILDREN = settings.has('stacktree_top_k') ? settings.get('stacktree_top_k') : 20;
+var FG_DEPTH = 8;
+memoro.set_stacktree_top_k(FG_CHILDREN);
+var flame_tree = null;
+var flame_graph = null;
 
 var avg_lifetime;
 var avg_usage;
@@ -82,6 +118,11 @@ var useful_life_var;
 var aggregate_max = 0;
 var filter_words = [];
 
+// traces and chunks come from memoro as columns, one typed array per
+// field. trace text and type names are fetched once and cached
+var type_names = [];
+var trace_texts = {};
+
 var colors = [
 "#b0c4de",
 "#b0c4de",
@@ -117,19 +158,102 @@ var badness_colors = [
 var colorScale = d3.scaleQuantile()
 .range(colors);
 
+// loaders shown and not hidden yet. async work may be superseded, so
+// several can overlap, only one spinner is drawn for all of them
+var num_loaders = 0;
+
 function showLoader() {
+    if (num_loaders++ > 0)
+        return;
     var div = document.createElement("div");
     div.id = "loadspinner";
     div.className = "spinny-load";
     div.html = "Loading ...";
     document.getElementById("middle-column").appendChild(div);
+
+    var progress = document.createElement("div");
+    progress.id = "load-progress";
+    progress.style.textAlign = "center";
+    document.getElementById("middle-column").appendChild(progress);
 }
 
 function hideLoader() {
+    if (num_loaders === 0 || --num_loaders > 0)
+        return;
     // completely remove, otherwise it takes CPU cycles while
     // animating, even if hidden?
     var element = document.getElementById("loadspinner");
-    element.parentNode.removeChild(element);
+    if (element !== null)
+        element.parentNode.removeChild(element);
+    element = document.getElementById("load-progress");
+    if (element !== null)
+        element.parentNode.removeChild(element);
+    d3.select("#loading-bar .progress-bar").style("width", "5%");
+}
+
+var loading_state_text = {
+    load_data: "Reading trace files",
+    parsing: "Parsing traces",
+    sorting: "Sorting chunks",
+    building: "Building indexes",
+    aggregating: "Aggregating",
+    scoring: "Scoring traces",
+    done: "Done"
+};
+
+// progress events of set_dataset, about 10 per second. the dataset is
+// locked while loading, so nothing here may call into memoro
+function showLoadProgress(p) {
+    var text = loading_state_text[p.state_name];
+    var fraction = p.total > 0 ? p.items / p.total : 0;
+    if (p.total > 0)
+        text += " " + p.items + " / " + p.total;
+    text += " (" + bytesToStringNoDecimal(p.bytes_read) + " read)";
+
+    var div = d3.select("#load-progress");
+    div.selectAll("p").remove();
+    div.append("p").text(text);
+
+    // the overall position, each state gets an equal share
+    var done = (p.state + Math.min(fraction, 1)) / 6;
+    d3.select("#loading-bar .progress-bar").style("width", Math.max(5, done*100) + "%");
+
+    if (p.timeline)
+        drawLoadTimeline(p.timeline);
+}
+
+// a preview of the global aggregate, the timeline arrives before the
+// traces are scored
+function drawLoadTimeline(timeline) {
+    var width = window.innerWidth / 2;
+    var height = 100;
+
+    d3.select("#load-timeline").remove();
+    if (timeline.ts.length === 0)
+        return;
+
+    var px = d3.scaleLinear()
+        .domain(d3.extent(timeline.ts))
+        .range([0, width]);
+    var py = d3.scaleLinear()
+        .domain([0, d3.max(timeline.value)])
+        .range([height, 0]);
+    var line = d3.area()
+        .x(function(t) { return px(t); })
+        .y0(height)
+        .y1(function(t, i) { return py(timeline.value[i]); })
+        .curve(d3.curveStepAfter);
+
+    d3.select("#load-progress").append("svg")
+        .attr("id", "load-timeline")
+        .attr("width", width)
+        .attr("height", height)
+        .append("path")
+        .datum(timeline.ts)
+        .attr("fill", "none")
+        .attr("stroke", "steelblue")
+        .attr("stroke-width", 1.5)
+        .attr("d", line);
 }
 
 function showModal(title, body, icon = "") {
@@ -141,9 +265,75 @@ function showModal(title, body, icon = "") {
     $(".modal-body").html(body);
     $("#main-modal").modal("show")
 }
+// every memoro call on a dataset takes its id. datasets stay open once
+// loaded, opening the same file again switches back to it without a
+// reload. memoro evicts the ones not used for a while if they take too
+// much memory, those are loaded back in the background before they are
+// shown
+var dataset_id = 0;  // the dataset shown
+var dataset_file = null;
+var open_datasets = {};  // {id, filter_words} by data file
+var loading_id = 0;  // a dataset being loaded, closed if another is opened
+var reloading_file = null;  // an evicted dataset being loaded back
+
+// load an evicted dataset back with progress, then show it. it stays open
+// if another file is picked meanwhile
+function reloadDataset(datafile) {
+    showLoader();
+    reloading_file = datafile;
+    memoro.load_dataset(open_datasets[datafile].id, function(result) {
+        if (reloading_file !== datafile)
+            return;  // another file was picked
+        reloading_file = null;
+        hideLoader();
+        if (!result.result) {
+            // memoro closed it
+            delete open_datasets[datafile];
+            showModal("Error", "Reloading the file failed with error: " + result.message, "fa-exclamation-triangle");
+            return;
+        }
+        showDataset(datafile);
+    }, function(p) {
+        if (reloading_file === datafile)
+            showLoadProgress(p);
+    });
+}
+
+function showDataset(datafile) {
+    if (!memoro.dataset_loaded(open_datasets[datafile].id)) {
+        reloadDataset(datafile);
+        return;
+    }
+    if (dataset_file !== null && open_datasets[dataset_file] !== undefined)
+        open_datasets[dataset_file].filter_words = filter_words;
+    dataset_file = datafile;
+    dataset_id = open_datasets[datafile].id;
+    filter_words = open_datasets[datafile].filter_words;
+
+    type_names = memoro.type_names(dataset_id);
+    trace_texts = {};
+
+    // add default "main" filter?
+    drawEverything();
+}
+
 // file open callback function
 function updateData(datafile) {
 
+    if (loading_id !== 0) {
+        memoro.close_dataset(loading_id);
+        loading_id = 0;
+        hideLoader();
+    }
+    if (reloading_file !== null) {
+        reloading_file = null;
+        hideLoader();
+    }
+    if (open_datasets[datafile] !== undefined) {
+        showDataset(datafile);
+        return;
+    }
+
     showLoader();
 
     var folder = path.dirname(datafile);
@@ -153,20 +343,27 @@ function updateData(datafile) {
     var trace_path = folder + "/" + name + ".trace";
     var chunk_path = folder + "/" + name + ".chunks";
     console.log("trace " + trace_path + " chunk path " + chunk_path);
-    // set dataset is async, because it can take some time with large trace files
-    memoro.set_dataset(folder+'/', trace_path, chunk_path, function(result) {
+    // set dataset is async, because it can take some time with large trace files.
+    // the dataset shown stays up until the new one replaces it
+    var id = memoro.set_dataset(folder+'/', trace_path, chunk_path, function(result) {
+        if (result.id !== loading_id)
+            return;  // closed, another file was opened
+        loading_id = 0;
         hideLoader();
         //console.log(result);
         if (!result.result) {
             showModal("Error", "File parsing failed with error: " + result.message, "fa-exclamation-triangle");
         } else {
-
-            // add default "main" filter?
-            drawEverything();
+            open_datasets[datafile] = {id: result.id, filter_words: []};
+            showDataset(datafile);
         }
         var element = document.querySelector("#overlay");
         element.style.visibility = "hidden";
+    }, function(p) {
+        if (id === loading_id)
+            showLoadProgress(p);
     });
+    loading_id = id;
 }
 
 function badnessTooltip(idx) {
@@ -229,7 +426,7 @@ function constructInferences(inef) {
 
 var current_sort_order = 'bytes';
 function sortTraces() {
-    memoro.sort_traces(current_sort_order);
+    memoro.sort_traces(dataset_id, current_sort_order);
 }
 
 function generateOpenSourceCmd(file, line) {
@@ -374,15 +571,16 @@ function traceScroll() {
     var element = document.querySelector("#traces");
     var percent = 100 * element.scrollTop / (element.scrollHeight - element.clientHeight);
     if (percent > load_threshold) {
-        var traces = memoro.traces(current_stacktrace_index, stacktraces_count);
+        var traces = memoro.traces(dataset_id, current_stacktrace_index, stacktraces_count);
         if (traces.length > 0) {
             // there are still some to display
             var to_append = traces.length;
             var to_remove = to_append;
             // remove from top
             for (var i = 0; i < to_append; i++) {
-                var sampled = memoro.aggregate_trace(traces[i].trace_index);
-                renderStackTraceSvg(traces[i], i, sampled, true);
+                var row = traceRow(traces, i);
+                var sampled = memoro.aggregate_trace(dataset_id, row.trace_index);
+                renderStackTraceSvg(row, i, sampled, true);
             }
             current_stacktrace_index += to_append;
             current_stacktrace_index_low += to_append;
@@ -391,7 +589,7 @@ function traceScroll() {
         }
     } else if (percent < (100 - load_threshold)) {
         if (current_stacktrace_index_low > 0) {
-            var traces = memoro.traces(
+            var traces = memoro.traces(dataset_id, 
                 Math.max(current_stacktrace_index_low - stacktraces_count, 0), // Don't go <0
                 Math.min(stacktraces_count, current_stacktrace_index_low)); // Don't ask <0
             if (traces.length === 0)
@@ -400,8 +598,9 @@ function traceScroll() {
             var to_remove = to_prepend;
 
             for (i = traces.length-1; i >= 0; i--) {
-                var sampled = memoro.aggregate_trace(traces[i].trace_index);
-                renderStackTraceSvg(traces[i], i, sampled, false);
+                var row = traceRow(traces, i);
+                var sampled = memoro.aggregate_trace(dataset_id, row.trace_index);
+                renderStackTraceSvg(row, i, sampled, false);
             }
             current_stacktrace_index -= to_prepend;
             current_stacktrace_index_low -= to_prepend;
@@ -439,31 +638,31 @@ function renderStackTraceSvg(d, i, sampled, bottom) {
             } else {
                 colorScale.domain([1, peak]);
 
-                generateTraceHtml(d.trace);
+                generateTraceHtml(traceText(d.trace_index));
 
                 d3.selectAll(".select-rect").style("display", "none");
                 d3.select(this).selectAll(".select-rect").style("display", "inline");
                 d3.select(this).classed("selected", true);
                 drawChunks(d);
                 var info = d3.select("#inferences");
-                var inef = memoro.inefficiencies(d.trace_index);
+                var inef = memoro.inefficiencies(dataset_id, d.trace_index);
                 var html = constructInferences(inef);
                 html += "</br>Usage: " + d.usage_score.toFixed(2) + "</br>Lifetime: " + d.lifetime_score.toFixed(2)
                     + "</br>Useful Lifetime: " + d.useful_lifetime_score.toFixed(2);
                 info.html(html);
 
-                var fresh_sampled = memoro.aggregate_trace(d.trace_index);
+                var fresh_sampled = memoro.aggregate_trace(dataset_id, d.trace_index);
                 var agg_line = d3.line()
-                    .x(function(v) {
-                        return x(v["ts"]);
+                    .x(function(t) {
+                        return x(t);
                     })
-                    .y(function(v) { return y(v["value"]); })
+                    .y(function(t, j) { return y(fresh_sampled.value[j]); })
                     .curve(d3.curveStepAfter);
 
                 d3.select("#stack-agg-path").remove();
                 var aggregate_graph_g = d3.select("#aggregate-group");
                 aggregate_graph_g.append("path")
-                    .datum(fresh_sampled)
+                    .datum(fresh_sampled.ts)
                     .attr("id", "stack-agg-path")
                     .attr("fill", "none")
                     .classed("stack-agg-graph", true)
@@ -513,7 +712,7 @@ function renderStackTraceSvg(d, i, sampled, bottom) {
         .style("display", "none")
         .classed("select-rect", true);
 
-    //sampled = memoro.aggregate_trace(d.trace_index);
+    //sampled = memoro.aggregate_trace(dataset_id, d.trace_index);
 
     var t = new_svg_g.append("text");
     t.style("font-size", "small")
@@ -526,21 +725,21 @@ function renderStackTraceSvg(d, i, sampled, bottom) {
     var stack_y = d3.scaleLinear()
         .range([rectHeight-25, 0]);
 
-    stack_y.domain(d3.extent(sampled, function(v) { return v["value"]; }));
+    stack_y.domain(d3.extent(sampled.value));
 
     var yAxisRight = d3.axisRight(stack_y)
         .tickFormat(bytesToStringNoDecimal)
         .ticks(2);
 
     var line = d3.line()
-        .x(function(v) {
-            return x(v["ts"]);
+        .x(function(t) {
+            return x(t);
         })
-        .y(function(v) { return stack_y(v["value"]); })
+        .y(function(t, j) { return stack_y(sampled.value[j]); })
         .curve(d3.curveStepAfter);
 
     new_svg_g.append("path")
-        .datum(sampled)
+        .datum(sampled.ts)
         .attr("fill", "none")
         .classed("stack-agg-overlay", true)
         .attr("stroke-width", 1.0)
@@ -564,15 +763,15 @@ function drawStackTraces() {
     d3.select("#inferences").html("");
 
     //var max_x = xMax();
-    var max_x = memoro.filter_max_time();
-    var min_x = memoro.filter_min_time();
+    var max_x = memoro.filter_max_time(dataset_id);
+    var min_x = memoro.filter_min_time(dataset_id);
 
     x.domain([min_x, max_x]);
 
     sortTraces();
     current_stacktrace_index_low = 0;
     current_stacktrace_index = stacktraces_count * 3;
-    var traces = memoro.traces(current_stacktrace_index_low, current_stacktrace_index);
+    var traces = memoro.traces(dataset_id, current_stacktrace_index_low, current_stacktrace_index);
     num_traces = traces.length;
     total_chunks = 0;
 
@@ -581,16 +780,17 @@ function drawStackTraces() {
     var total_useful_lifetime = 0;
 
     var cur_background_class = 0;
-    traces.forEach(function (d, i) {
+    for (var i = 0; i < traces.length; i++) {
+        var d = traceRow(traces, i);
         total_usage += d.usage_score;
         total_lifetime += d.lifetime_score;
         total_useful_lifetime += d.useful_lifetime_score;
 
-        var sampled = memoro.aggregate_trace(d.trace_index);
+        var sampled = memoro.aggregate_trace(dataset_id, d.trace_index);
         total_chunks += d.num_chunks;
 
         renderStackTraceSvg(d, i, sampled, true);
-    });
+    }
 
     avg_lifetime = total_lifetime / traces.length;
     avg_usage = total_usage / traces.length;
@@ -599,28 +799,29 @@ function drawStackTraces() {
     var lifetime_var_total = 0;
     var usage_var_total = 0;
     var useful_lifetime_var_total = 0;
-    traces.forEach(function(t) {
-        lifetime_var_total += Math.pow(t.lifetime_score - avg_lifetime, 2);
-        usage_var_total += Math.pow(t.usage_score - avg_usage, 2);
-        useful_lifetime_var_total += Math.pow(t.useful_lifetime_score - avg_useful_life, 2);
-    });
+    for (var i = 0; i < traces.length; i++) {
+        lifetime_var_total += Math.pow(traces.lifetime_score[i] - avg_lifetime, 2);
+        usage_var_total += Math.pow(traces.usage_score[i] - avg_usage, 2);
+        useful_lifetime_var_total += Math.pow(traces.useful_lifetime_score[i] - avg_useful_life, 2);
+    }
 
     lifetime_var = lifetime_var_total / traces.length;
     usage_var = usage_var_total / traces.length;
     useful_life_var = useful_lifetime_var_total / traces.length;
 }
 
-function tooltip(chunk) {
+// chunk i of a memoro.trace_chunks() page
+function tooltip(chunks, i) {
     return function() {
         var div = d3.select("#tooltip")
         div.transition()
             .duration(200)
             .style("opacity", .9);
-        div .html(bytesToString(chunk["size"]) + "</br> Reads: " + chunk["num_reads"]
-            + "</br>Writes: " + chunk["num_writes"] + "</br>Access Ratio: " +
-            ((chunk.access_interval_high - chunk.access_interval_low) / chunk.size).toFixed(1)
-            + "</br>Access Interval: [" + chunk.access_interval_low + "," + chunk.access_interval_high
-            + "]</br>MultiThread: " + chunk.multi_thread + "</br>")
+        div .html(bytesToString(chunks.size[i]) + "</br> Reads: " + chunks.num_reads[i]
+            + "</br>Writes: " + chunks.num_writes[i] + "</br>Access Ratio: " +
+            ((chunks.access_interval_high[i] - chunks.access_interval_low[i]) / chunks.size[i]).toFixed(1)
+            + "</br>Access Interval: [" + chunks.access_interval_low[i] + "," + chunks.access_interval_high[i]
+            + "]</br>MultiThread: " + (chunks.multi_thread[i] !== 0) + "</br>")
             .style("left", (d3.event.pageX) + "px")
             .style("top", (d3.event.pageY - 100) + "px");
         div.append("svg")
@@ -629,13 +830,14 @@ function tooltip(chunk) {
             .append("rect")
             .attr("width", 10)
             .attr("height", 10)
-            .style("fill", colorScale(chunk.size))
+            .style("fill", colorScale(chunks.size[i]))
         //div.attr("width", width);
     }
 }
 
-function renderChunkSvg(chunk, text, bottom) {
-    var min_x = memoro.filter_min_time()
+// chunk i of a memoro.trace_chunks() page
+function renderChunkSvg(chunks, i, text, bottom) {
+    var min_x = memoro.filter_min_time(dataset_id)
 
 
     var chunk_div = d3.select("#chunks");
@@ -652,11 +854,11 @@ function renderChunkSvg(chunk, text, bottom) {
         .attr("height", barHeight)
         .classed("svg_spacing_data", true);
     new_svg_g.append("rect")
-        .attr("transform", "translate("+ x(chunk["ts_start"])  +",0)")
-        .attr("width", Math.max(x(min_x + chunk["ts_end"] - chunk["ts_start"]), 3))
+        .attr("transform", "translate("+ x(chunks.ts_start[i])  +",0)")
+        .attr("width", Math.max(x(min_x + chunks.ts_end[i] - chunks.ts_start[i]), 3))
         .attr("height", barHeight)
-        .style("fill", colorScale(chunk.size))
-        .on("mouseover", tooltip(chunk))
+        .style("fill", colorScale(chunks.size[i]))
+        .on("mouseover", tooltip(chunks, i))
         .on("mouseout", function(d) {
             div.transition()
                 .duration(500)
@@ -671,25 +873,25 @@ function renderChunkSvg(chunk, text, bottom) {
     new_svg_g.append("line")
         .attr("y1", 0)
         .attr("y2", barHeight)
-        .attr("x1", x(chunk["ts_first"]))
-        .attr("x2", x(chunk["ts_first"]))
+        .attr("x1", x(chunks.ts_first[i]))
+        .attr("x2", x(chunks.ts_first[i]))
         .style("stroke-width", 2)
-        .attr("display", chunk["ts_first"] === 0 ? "none" : null)
+        .attr("display", chunks.ts_first[i] === 0 ? "none" : null)
         .classed("firstlastbars", true);
 
     var next = 0;
-    if (x(chunk["ts_last"]) - x(chunk["ts_first"]) < 1)
+    if (x(chunks.ts_last[i]) - x(chunks.ts_first[i]) < 1)
     {
-        next = x(chunk["ts_first"]) + 3;
+        next = x(chunks.ts_first[i]) + 3;
     } else {
-        next = x(chunk["ts_last"]);
+        next = x(chunks.ts_last[i]);
     }
     new_svg_g.append("line")
         .attr("y1", 0)
         .attr("y2", barHeight)
         .attr("x1", next)
         .attr("x2", next)
-        .attr("display", chunk["ts_first"] === 0 ? "none" : null)
+        .attr("display", chunks.ts_first[i] === 0 ? "none" : null)
         .style("stroke-width", 2)
         .classed("firstlastbars", true);
 }
@@ -723,14 +925,14 @@ function chunkScroll() {
     var element = document.querySelector("#chunks");
     var percent = 100 * element.scrollTop / (element.scrollHeight - element.clientHeight);
     if (percent > load_threshold) {
-        var chunks = memoro.trace_chunks(current_trace_index, current_chunk_index, 25);
+        var chunks = memoro.trace_chunks(dataset_id, current_trace_index, current_chunk_index, 25);
         if (chunks.length > 0) {
             // there are still some to display
             var to_append = chunks.length;
             var to_remove = to_append;
             // remove from top
             for (var i = 0; i < to_append; i++) {
-                renderChunkSvg(chunks[i], current_chunk_index + i, true);
+                renderChunkSvg(chunks, i, current_chunk_index + i, true);
             }
             current_chunk_index += to_append;
             current_chunk_index_low += to_append;
@@ -739,14 +941,14 @@ function chunkScroll() {
         }
     } else if (percent < (100 - load_threshold)) {
         if (current_chunk_index_low > 0) {
-            var chunks = memoro.trace_chunks(current_trace_index, Math.max(current_chunk_index_low-25, 0), Math.min(25, current_chunk_index_low));
+            var chunks = memoro.trace_chunks(dataset_id, current_trace_index, Math.max(current_chunk_index_low-25, 0), Math.min(25, current_chunk_index_low));
             if (chunks.length === 0)
                 console.log("oh fuck chunks is 0");
             var to_prepend = chunks.length;
             var to_remove = to_prepend;
 
             for (i = chunks.length-1; i >= 0; i--) {
-                renderChunkSvg(chunks[i], current_chunk_index_low - (to_prepend - i), false);
+                renderChunkSvg(chunks, i, current_chunk_index_low - (to_prepend - i), false);
             }
             current_chunk_index -= to_prepend;
             current_chunk_index_low -= to_prepend;
@@ -779,18 +981,18 @@ function drawChunks(trace) {
 
     chunk_div.selectAll("div").remove();
 
-    var max_x = memoro.filter_max_time();
-    var min_x = memoro.filter_min_time();
+    var max_x = memoro.filter_max_time(dataset_id);
+    var min_x = memoro.filter_min_time(dataset_id);
     //console.log("min x " + min_x + " max x " + max_x)
 
     x.domain([min_x, max_x]);
 
     current_chunk_index_low = trace.chunk_index;
     current_chunk_index = Math.min(trace.num_chunks, 200);
-    chunks  = memoro.trace_chunks(trace.trace_index, current_chunk_index_low, current_chunk_index);
+    chunks  = memoro.trace_chunks(dataset_id, trace.trace_index, current_chunk_index_low, current_chunk_index);
 
     for (var i = 0; i < chunks.length; i++) {
-        renderChunkSvg(chunks[i], current_chunk_index_low + i, true);
+        renderChunkSvg(chunks, i, current_chunk_index_low + i, true);
     }
 
     // add the gradient heatmap scale
@@ -821,7 +1023,7 @@ function drawChunks(trace) {
 
 function xMax() {
     // find the max TS value
-    return memoro.filter_max_time();
+    return memoro.filter_max_time(dataset_id);
 }
 
 function drawChunkXAxis() {
@@ -836,8 +1038,8 @@ function drawChunkXAxis() {
         .ticks(7)
         //.orient("bottom");
 
-    var max_x = memoro.filter_max_time();
-    var min_x = memoro.filter_min_time();
+    var max_x = memoro.filter_max_time(dataset_id);
+    var min_x = memoro.filter_min_time(dataset_id);
 
     x.domain([min_x, max_x]);
 
@@ -866,8 +1068,8 @@ function drawAggregateAxis() {
         .ticks(7)
         .tickSizeInner(-120);
 
-    var max_x = memoro.filter_max_time();
-    var min_x = memoro.filter_min_time();
+    var max_x = memoro.filter_max_time(dataset_id);
+    var min_x = memoro.filter_min_time(dataset_id);
 
     x.domain([min_x, max_x]);
 
@@ -919,26 +1121,26 @@ function drawGlobalAggregatePath() {
     max_x = xMax();
     global_x.domain([0, max_x]);
 
-    var aggregate_data = memoro.aggregate_all();
+    var aggregate_data = memoro.aggregate_all(dataset_id);
 
-    aggregate_max = memoro.max_aggregate();
+    aggregate_max = memoro.max_aggregate(dataset_id);
     var binned_ag = aggregate_data;
 
-    y.domain(d3.extent(binned_ag, function(v) { return v["value"]; }));
+    y.domain(d3.extent(binned_ag.value));
 
     var yAxisRight = d3.axisRight(y)
         .ticks(5)
         .tickFormat(bytesToStringNoDecimal);
 
     var line = d3.line()
-        .x(function(v) { return global_x(v["ts"]); })
-        .y(function(v) { return y(v["value"]); })
+        .x(function(t) { return global_x(t); })
+        .y(function(t, i) { return y(binned_ag.value[i]); })
         .curve(d3.curveStepAfter);
 
     var area = d3.area()
-        .x(function(v) { return global_x(v["ts"]); })
+        .x(function(t) { return global_x(t); })
         .y0(aggregate_graph_height*0.8 - 10)
-        .y1(function(v) { return y(v["value"]); })
+        .y1(function(t, i) { return y(binned_ag.value[i]); })
         .curve(d3.curveStepAfter);
 
     d3.select("#fg-aggregate-path").remove();
@@ -958,7 +1160,7 @@ function drawGlobalAggregatePath() {
     console.log("y axis height is " + aggregate_graph_height)
 
     fg_aggregate_graph_g.append("path")
-        .datum(binned_ag)
+        .datum(binned_ag.ts)
         .attr("fill", "none")
         .attr("stroke", "steelblue")
         .attr("stroke-width", 1.5)
@@ -975,7 +1177,7 @@ function drawGlobalAggregatePath() {
         .call(yAxisRight);
 
     fg_aggregate_graph_g.append("path")
-        .datum(binned_ag)
+        .datum(binned_ag.ts)
         .classed("area", true)
         .attr("transform", "translate(0, 5)")
         .attr("id", "fg-aggregate-area")
@@ -1009,10 +1211,8 @@ function drawGlobalAggregatePath() {
     // display on mouseover
     function mousemove() {
         var x0 = global_x.invert(d3.mouse(this)[0]);
-        var y_pos = d3.bisector(function(d) {
-            return d["ts"];
-        }).left(binned_ag, x0, 1);
-        var y = binned_ag[y_pos-1]["value"];
+        var y_pos = d3.bisectLeft(binned_ag.ts, x0, 1);
+        var y = binned_ag.value[y_pos-1];
         focus_g.attr("transform", "translate(" + global_x(x0) + ",0)");
         focus_g.select("#time").text(Math.round(x0) + "c " + bytesToString(y));
         if (d3.mouse(this)[0] > fg_width / 2)
@@ -1030,26 +1230,26 @@ function drawAggregatePath() {
 
     max_x = xMax();
 
-    var aggregate_data = memoro.aggregate_all();
+    var aggregate_data = memoro.aggregate_all(dataset_id);
 
-    aggregate_max = memoro.max_aggregate();
+    aggregate_max = memoro.max_aggregate(dataset_id);
     var binned_ag = aggregate_data;
 
-    y.domain(d3.extent(binned_ag, function(v) { return v["value"]; }));
+    y.domain(d3.extent(binned_ag.value));
 
     var yAxisRight = d3.axisRight(y)
         .ticks(5)
         .tickFormat(bytesToStringNoDecimal);
 
     var line = d3.line()
-        .x(function(v) { return x(v["ts"]); })
-        .y(function(v) { return y(v["value"]); })
+        .x(function(t) { return x(t); })
+        .y(function(t, i) { return y(binned_ag.value[i]); })
         .curve(d3.curveStepAfter);
 
     var area = d3.area()
-        .x(function(v) { return x(v["ts"]); })
+        .x(function(t) { return x(t); })
         .y0(aggregate_graph_height*0.8 - 10)
-        .y1(function(v) { return y(v["value"]); })
+        .y1(function(t, i) { return y(binned_ag.value[i]); })
         .curve(d3.curveStepAfter);
 
     d3.select("#aggregate-path").remove();
@@ -1067,7 +1267,7 @@ function drawAggregatePath() {
 
     var yaxis_height = .8 * aggregate_graph_height;
     aggregate_graph_g.append("path")
-        .datum(binned_ag)
+        .datum(binned_ag.ts)
         .attr("fill", "none")
         .attr("stroke", "steelblue")
         .attr("stroke-width", 1.5)
@@ -1083,7 +1283,7 @@ function drawAggregatePath() {
         .call(yAxisRight);
 
     aggregate_graph_g.append("path")
-        .datum(binned_ag)
+        .datum(binned_ag.ts)
         .classed("area", true)
         .attr("transform", "translate(0, 5)")
         .attr("id", "aggregate-area")
@@ -1116,10 +1316,8 @@ function drawAggregatePath() {
     // display on mouseover
     function mousemove() {
         var x0 = x.invert(d3.mouse(this)[0]);
-        var y_pos = d3.bisector(function(d) {
-            return d["ts"];
-        }).left(binned_ag, x0, 1);
-        var y = binned_ag[y_pos-1]["value"];
+        var y_pos = d3.bisectLeft(binned_ag.ts, x0, 1);
+        var y = binned_ag.value[y_pos-1];
         focus_g.attr("transform", "translate(" + x(x0) + ",0)");
         focus_g.select("#time").text(Math.round(x0) + "c " + bytesToString(y));
         if (d3.mouse(this)[0] > chunk_graph_width / 2)
@@ -1183,6 +1381,14 @@ var colorMapper = function(d) {
     return d.highlight ? "#E600E6" : colorHash(name(d));
 };
 
+// children of a node fetched so far, as an offset for the next page. kept
+// apart from children.length, filterTree takes children out again
+function markLoaded(tree) {
+    tree.loaded = 'children' in tree ? tree.children.length : 0;
+    if ('children' in tree)
+        tree.children.forEach(markLoaded);
+}
+
 function filterTree(tree) {
 
     if (filter_words.length === 0)
@@ -1208,33 +1414,45 @@ function filterTree(tree) {
         }
     }
 
+    // children not loaded yet may have the keyword, keep the node so
+    // they can be expanded
+    var unloaded = (tree.loaded || 0) < (tree.num_children || 0);
     if ('children' in tree && tree.children.length === 0) {
         delete tree.children;
-        return true;
+        return !unloaded;
     } else if (!('children' in tree))
-        return true;
+        return !unloaded;
     else return false;
 
 
 }
 
 function drawFlameGraph() {
+    // summed up off the main thread, a newer call cancels an older one
+    var done = function(result) {
+        if (result.result)
+            renderFlameGraph();
+    };
     switch (current_fg_type) {
       case "bytes_time":
-        memoro.stacktree_by_bytes(current_fg_time);
+        memoro.stacktree_by_bytes_async(dataset_id, current_fg_time, done);
         break;
       case "bytes_total":
-        memoro.stacktree_by_bytes_total(current_fg_time);
+        memoro.stacktree_by_bytes_total_async(dataset_id, done);
         break;
       case "num_allocs":
       default:
-        memoro.stacktree_by_numallocs();
+        memoro.stacktree_by_numallocs_async(dataset_id, done);
     }
+}
 
-    var tree = memoro.stacktree();
+function renderFlameGraph() {
+    var tree = memoro.stacktree(dataset_id, FG_CHILDREN + 1, FG_DEPTH);
+    markLoaded(tree);
     filterTree(tree); // it just seems easier to filter this here ...
     console.log(tree);
     d3.select("#flame-graph-div").html("");
+    flame_tree = tree;
 
     var fg_width = window.innerWidth *0.70; // getboundingclientrect isnt working i dont understand this crap
     var fgg = d3.flameGraph()
@@ -1249,9 +1467,7 @@ function drawFlameGraph() {
         //.sort(function(a,b){ return d3.descending(a.name, b.name);})
         .title("");
 
-/*    fgg.onClick(function (d) {
-        console.info("You clicked on frame "+ d.data.name);
-    });*/
+    fgg.onClick(expandFlameNode);
 
     var tip = d3.tip()
         .direction("s")
@@ -1279,11 +1495,34 @@ function drawFlameGraph() {
 
     fgg.details(details);
 
+    flame_graph = fgg;
     d3.select("#flame-graph-div")
         .datum(tree)
         .call(fgg);
 }
 
+// load the next page of children of a clicked node that has more than
+// are loaded, then draw the graph again
+function expandFlameNode(d) {
+    var node = d.data;
+    var loaded = node.loaded || 0;
+    if (node.id < 0 || loaded >= node.num_children)
+        return;
+
+    var more = memoro.stacktree_children(dataset_id, node.id, loaded, FG_CHILDREN + 1);
+    if (more.length === 0)
+        return;
+    more.forEach(markLoaded);
+    node.loaded = loaded + more.length;
+    node.children = (node.children || []).concat(more);
+    filterTree(flame_tree);
+
+    d3.select("#flame-graph-div").html("");
+    d3.select("#flame-graph-div")
+        .datum(flame_tree)
+        .call(flame_graph);
+}
+
 function tabSwitchClick() {
 
     // doing this because when you start on global tab,
@@ -1385,19 +1624,22 @@ function drawEverything() {
         var t1 = x.invert(x1);
         var t2 = x.invert(x2);
         selection.remove();
-        // set time filter
-        memoro.set_filter_minmax(t1, t2);
-
-        // redraw
-        clearChunks();
+        // set time filter off the main thread, only the last of several
+        // quick selections is applied and redrawn
+        memoro.set_filter_minmax_async(dataset_id, t1, t2, function(result) {
+            if (!result.result)
+                return;
+            // redraw
+            clearChunks();
 
-        drawStackTraces();
+            drawStackTraces();
 
-        drawAggregatePath();
-        drawAggregateAxis();
+            drawAggregatePath();
+            drawAggregateAxis();
 
-        drawChunkXAxis();
-        setGlobalInfo();
+            drawChunkXAxis();
+            setGlobalInfo();
+        });
 
     });
 
@@ -1449,7 +1691,7 @@ function drawEverything() {
 }
 
 function setGlobalInfo() {
-    var traces = memoro.traces();
+    var traces = memoro.traces(dataset_id);
     num_traces = traces.length;
     total_chunks = 0;
 
@@ -1457,14 +1699,13 @@ function setGlobalInfo() {
     var total_lifetime = 0;
     var total_useful_lifetime = 0;
 
-    traces.forEach(function (d) {
+    for (var i = 0; i < traces.length; i++) {
+        total_usage += traces.usage_score[i];
+        total_lifetime += traces.lifetime_score[i];
+        total_useful_lifetime += traces.useful_lifetime_score[i];
 
-        total_usage += d.usage_score;
-        total_lifetime += d.lifetime_score;
-        total_useful_lifetime += d.useful_lifetime_score;
-
-        total_chunks += d.num_chunks;
-    });
+        total_chunks += traces.num_chunks[i];
+    }
 
     avg_lifetime = total_lifetime / traces.length;
     avg_usage = total_usage / traces.length;
@@ -1474,18 +1715,18 @@ function setGlobalInfo() {
     var usage_var_total = 0;
     var useful_lifetime_var_total = 0;
 
-    traces.forEach(function(t) {
-        lifetime_var_total += Math.pow(t.lifetime_score - avg_lifetime, 2);
-        usage_var_total += Math.pow(t.usage_score - avg_usage, 2);
-        useful_lifetime_var_total += Math.pow(t.useful_lifetime_score - avg_useful_life, 2);
-    });
+    for (var i = 0; i < traces.length; i++) {
+        lifetime_var_total += Math.pow(traces.lifetime_score[i] - avg_lifetime, 2);
+        usage_var_total += Math.pow(traces.usage_score[i] - avg_usage, 2);
+        useful_lifetime_var_total += Math.pow(traces.useful_lifetime_score[i] - avg_useful_life, 2);
+    }
 
     lifetime_var = lifetime_var_total / traces.length;
     usage_var = usage_var_total / traces.length;
     useful_life_var = useful_lifetime_var_total / traces.length;
 
-    var alloc_time = memoro.global_alloc_time();
-    var time_total = memoro.max_time() - memoro.min_time();
+    var alloc_time = memoro.global_alloc_time(dataset_id);
+    var time_total = memoro.max_time(dataset_id) - memoro.min_time(dataset_id);
     var percent_alloc_time = 100.0 * alloc_time / time_total;
     var info = d3.select("#global-info");
 
@@ -1530,7 +1771,7 @@ function stackFilter() {
         for (var w in filterWords) {
             filter_words.push(filterWords[w]);
             console.log("setting filter " + filterWords[w]);
-            memoro.set_trace_keyword(filterWords[w]);
+            memoro.set_trace_keyword(dataset_id, filterWords[w]);
         }
         clearChunks();
         drawStackTraces();
@@ -1550,8 +1791,10 @@ function stackFilterResetClick() {
     //drawChunks();
     showLoader();
     filter_words = [];
-    setTimeout(function() {
-        memoro.trace_filter_reset();
+    memoro.trace_filter_reset_async(dataset_id, function(result) {
+        hideLoader();
+        if (!result.result)
+            return;
         clearChunks();
         drawStackTraces();
         drawChunkXAxis();
@@ -1561,9 +1804,8 @@ function stackFilterResetClick() {
         drawGlobalAggregatePath();
         drawGlobalAggregateAxis();
         drawFlameGraph();
-        hideLoader();
         setGlobalInfo();
-    }, 100);
+    });
 }
 
 function typeFilter() {
@@ -1576,7 +1818,7 @@ function typeFilter() {
 
         for (var w in filterWords) {
             console.log("setting filter " + filterWords[w]);
-            memoro.set_type_keyword(filterWords[w]);
+            memoro.set_type_keyword(dataset_id, filterWords[w]);
         }
         clearChunks();
         drawStackTraces();
@@ -1595,8 +1837,10 @@ function typeFilter() {
 function typeFilterResetClick() {
     //drawChunks();
     showLoader();
-    setTimeout(function() {
-        memoro.type_filter_reset();
+    memoro.type_filter_reset_async(dataset_id, function(result) {
+        hideLoader();
+        if (!result.result)
+            return;
         clearChunks();
         drawStackTraces();
         drawChunkXAxis();
@@ -1606,9 +1850,8 @@ function typeFilterResetClick() {
         drawGlobalAggregatePath();
         drawGlobalAggregateAxis();
         drawFlameGraph();
-        hideLoader();
         setGlobalInfo();
-    }, 100);
+    });
 }
 
 function filterExecuteClick() {
@@ -1620,17 +1863,18 @@ function filterExecuteClick() {
 
 function resetTimeClick() {
     showLoader();
-    setTimeout(function() {
-        memoro.filter_minmax_reset();
+    memoro.filter_minmax_reset_async(dataset_id, function(result) {
+        hideLoader();
+        if (!result.result)
+            return;
         clearChunks();
         drawStackTraces();
         drawChunkXAxis();
 
         drawAggregatePath();
         drawAggregateAxis();
-        hideLoader();
         setGlobalInfo();
-    }, 100);
+    });
 }
 
 function showFilterHelp() {